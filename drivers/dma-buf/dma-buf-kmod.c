@@ -32,3 +32,6 @@ __FBSDID("$FreeBSD$");
 
 MODULE_VERSION(dmabuf, 1);
 MODULE_DEPEND(dmabuf, linuxkpi, 1, 1, 1);
+#ifdef CONFIG_DEBUG_FS
+MODULE_DEPEND(dmabuf, lindebugfs, 1, 1, 1);
+#endif
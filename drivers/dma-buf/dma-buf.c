@@ -68,6 +68,9 @@ struct db_list {
 };
 
 static struct db_list db_list;
+
+SYSCTL_NODE(_hw, OID_AUTO, dmabuf, CTLFLAG_RW | CTLFLAG_MPSAFE, 0,
+    "dma-buf statistics");
 MALLOC_DEFINE(M_DMABUF, "dmabuf", "dmabuf allocator");
 
 static fo_close_t dma_buf_close;
@@ -28,12 +28,64 @@
 #include <linux/export.h>
 #endif
 #include <sys/param.h>
+#include <sys/kernel.h>
+
+#include <vm/uma.h>
 
 #include <linux/dma-fence-array.h>
+#include <linux/dma-fence-chain.h>
+#include <linux/sort.h>
 #include <linux/spinlock.h>
 
 MALLOC_DECLARE(M_DMABUF);
 
+/*
+ * Arrays of up to DMA_FENCE_ARRAY_ZONE_FENCES fences come from a zone.  The
+ * item has room for the callbacks and, for arrays built by
+ * dma_fence_array_builder_finish(), the fence pointers as well.
+ */
+#define	DMA_FENCE_ARRAY_ZONE_FENCES	8
+
+static uma_zone_t dma_fence_array_zone;
+
+static size_t
+dma_fence_array_size(unsigned int num_fences, bool inline_fences)
+{
+	size_t size;
+
+	size = sizeof(struct dma_fence_array_cb);
+	if (inline_fences)
+		size += sizeof(struct dma_fence *);
+	return (sizeof(struct dma_fence_array) + num_fences * size);
+}
+
+static struct dma_fence **
+dma_fence_array_inline_fences(struct dma_fence_array *array)
+{
+
+	return ((struct dma_fence **)
+	    ((struct dma_fence_array_cb *)&array[1] + array->num_fences));
+}
+
+static struct dma_fence_array *
+dma_fence_array_alloc(unsigned int num_fences, bool inline_fences)
+{
+
+	if (num_fences <= DMA_FENCE_ARRAY_ZONE_FENCES)
+		return (uma_zalloc(dma_fence_array_zone, M_WAITOK | M_ZERO));
+	return (malloc(dma_fence_array_size(num_fences, inline_fences),
+	    M_DMABUF, M_WAITOK | M_ZERO));
+}
+
+static void
+dma_fence_array_free_rcu(struct rcu_head *rcu)
+{
+	struct dma_fence *fence;
+
+	fence = container_of(rcu, struct dma_fence, rcu);
+	uma_zfree(dma_fence_array_zone, to_dma_fence_array(fence));
+}
+
 #ifdef BSDTNG
 #define PENDING_ERROR 1
 #endif
@@ -152,6 +204,20 @@ dma_fence_array_signaled(struct dma_fence *fence)
 	return true;
 }
 
+static void
+dma_fence_array_set_deadline(struct dma_fence *fence, ktime_t deadline)
+{
+	struct dma_fence_array *array;
+	int i;
+
+	array = to_dma_fence_array(fence);
+	if (array == NULL)
+		return;
+
+	for (i = 0; i < array->num_fences; i++)
+		dma_fence_set_deadline(array->fences[i], deadline);
+}
+
 static void
 dma_fence_array_release(struct dma_fence *fence)
 {
@@ -169,8 +235,12 @@ dma_fence_array_release(struct dma_fence *fence)
 #endif
 		dma_fence_put(array->fences[i]);
 
-	free(array->fences, M_DMABUF);
-	dma_fence_free(fence);
+	if (array->fences != dma_fence_array_inline_fences(array))
+		free(array->fences, M_DMABUF);
+	if (array->num_fences <= DMA_FENCE_ARRAY_ZONE_FENCES)
+		call_rcu(&fence->rcu, dma_fence_array_free_rcu);
+	else
+		dma_fence_free(fence);
 }
 
 const struct dma_fence_ops dma_fence_array_ops = {
@@ -179,11 +249,32 @@ const struct dma_fence_ops dma_fence_array_ops = {
 	.enable_signaling = dma_fence_array_enable_signaling,
 	.signaled = dma_fence_array_signaled,
 	.release = dma_fence_array_release,
+	.set_deadline = dma_fence_array_set_deadline,
 };
 #ifdef BSDTNG
 EXPORT_SYMBOL(dma_fence_array_ops);
 #endif
 
+static void
+dma_fence_array_init(struct dma_fence_array *array, int num_fences,
+    struct dma_fence **fences, u64 context, unsigned seqno,
+    bool signal_on_any)
+{
+
+	spin_lock_init(&array->lock);
+	dma_fence_init(&array->base, &dma_fence_array_ops,
+	  &array->lock, context, seqno);
+	init_irq_work(&array->work, irq_dma_fence_array_work);
+	array->num_fences = num_fences;
+	atomic_set(&array->num_pending, signal_on_any ? 1 : num_fences);
+	array->fences = fences;
+	array->signal_on_any = signal_on_any;
+
+#ifdef BSDTNG
+	array->base.error = PENDING_ERROR;
+#endif
+}
+
 /*
  * Create a custom fence array
  */
@@ -195,26 +286,14 @@ dma_fence_array_create(int num_fences,
 {
 	struct dma_fence_array *array;
 
-	array = malloc(sizeof(*array) +
-	    (num_fences * sizeof(struct dma_fence_array_cb)),
-	    M_DMABUF, M_WAITOK | M_ZERO);
+	array = dma_fence_array_alloc(num_fences, false);
 #ifdef BSDTNG
 	if (NULL == array)
 		return (NULL);
 #endif
 
-	spin_lock_init(&array->lock);
-	dma_fence_init(&array->base, &dma_fence_array_ops,
-	  &array->lock, context, seqno);
-	init_irq_work(&array->work, irq_dma_fence_array_work);
-	array->num_fences = num_fences;
-	atomic_set(&array->num_pending, signal_on_any ? 1 : num_fences);
-	array->fences = fences;
-
-#ifdef BSDTNG
-	array->base.error = PENDING_ERROR;
-#endif
-
+	dma_fence_array_init(array, num_fences, fences, context, seqno,
+	    signal_on_any);
 	return (array);
 }
 EXPORT_SYMBOL(dma_fence_array_create);
@@ -275,6 +354,175 @@ struct dma_fence *dma_fence_array_next(struct dma_fence *head,
 	return array->fences[index];
 }
 EXPORT_SYMBOL(dma_fence_array_next);
+
+/**
+ * DOC: fence array builder
+ *
+ * Merging fences from several sources, such as sync_files or the fences of
+ * a reservation object, tends to produce arrays full of already signaled
+ * fences, nested containers and several fences of the same context.  The
+ * builder collects fences with dma_fence_array_builder_add(), which looks
+ * through arrays and chains and skips fences that already signaled without
+ * error.  dma_fence_array_builder_finish() then keeps only the latest fence
+ * of each context and returns the result, which is a dma_fence_array only
+ * when more than one fence is left.
+ */
+
+/**
+ * dma_fence_array_builder_init - prepare a fence array builder
+ * @b: the builder
+ */
+void
+dma_fence_array_builder_init(struct dma_fence_array_builder *b)
+{
+
+	b->fences = b->inline_fences;
+	b->num_fences = 0;
+	b->max_fences = ARRAY_SIZE(b->inline_fences);
+}
+EXPORT_SYMBOL(dma_fence_array_builder_init);
+
+static void
+dma_fence_array_builder_push(struct dma_fence_array_builder *b,
+    struct dma_fence *fence)
+{
+	struct dma_fence **fences;
+
+	if (dma_fence_is_signaled(fence) && fence->error == 0)
+		return;
+
+	if (b->num_fences == b->max_fences) {
+		fences = malloc(2 * b->max_fences * sizeof(*fences),
+		    M_DMABUF, M_WAITOK);
+		memcpy(fences, b->fences, b->num_fences * sizeof(*fences));
+		if (b->fences != b->inline_fences)
+			free(b->fences, M_DMABUF);
+		b->fences = fences;
+		b->max_fences *= 2;
+	}
+	b->fences[b->num_fences++] = dma_fence_get(fence);
+}
+
+/**
+ * dma_fence_array_builder_add - add a fence to a fence array builder
+ * @b: the builder
+ * @fence: the fence to add
+ *
+ * Adds @fence to @b, taking a new reference.  A dma_fence_array which
+ * signals when all its fences do and a dma_fence_chain are replaced by the
+ * fences they contain.  Fences which already signaled without an error are
+ * dropped.
+ */
+void
+dma_fence_array_builder_add(struct dma_fence_array_builder *b,
+    struct dma_fence *fence)
+{
+	struct dma_fence_array *array;
+	struct dma_fence *iter;
+	unsigned int i;
+
+	if (dma_fence_is_chain(fence)) {
+		dma_fence_chain_for_each(iter, fence)
+			dma_fence_array_builder_add(b,
+			    dma_fence_chain_contained(iter));
+		return;
+	}
+
+	array = to_dma_fence_array(fence);
+	if (array != NULL && !array->signal_on_any) {
+		for (i = 0; i < array->num_fences; i++)
+			dma_fence_array_builder_add(b, array->fences[i]);
+		return;
+	}
+
+	dma_fence_array_builder_push(b, fence);
+}
+EXPORT_SYMBOL(dma_fence_array_builder_add);
+
+static int
+dma_fence_context_cmp(const void *a, const void *b)
+{
+	const struct dma_fence *fa = *(struct dma_fence * const *)a;
+	const struct dma_fence *fb = *(struct dma_fence * const *)b;
+
+	if (fa->context < fb->context)
+		return (-1);
+	return (fa->context > fb->context);
+}
+
+/**
+ * dma_fence_array_builder_finish - turn the collected fences into one fence
+ * @b: the builder
+ * @context: fence context of the array, if one is needed
+ * @seqno: sequence number of the array, if one is needed
+ *
+ * Keeps the latest fence of every context collected in @b and returns a
+ * single fence waiting for all of them, ordered by context.  This is NULL if
+ * no fence is left, the fence itself if only one is left and a new
+ * dma_fence_array otherwise.  The builder is empty afterwards and does not
+ * need dma_fence_array_builder_fini().
+ */
+struct dma_fence *
+dma_fence_array_builder_finish(struct dma_fence_array_builder *b,
+    u64 context, unsigned seqno)
+{
+	struct dma_fence_array *array;
+	struct dma_fence **fences;
+	struct dma_fence *fence;
+	unsigned int i, n;
+
+	fences = b->fences;
+	sort(fences, b->num_fences, sizeof(*fences), dma_fence_context_cmp,
+	    NULL);
+	for (i = n = 0; i < b->num_fences; i++) {
+		if (n > 0 && fences[n - 1]->context == fences[i]->context) {
+			if (__dma_fence_is_later(fences[i]->seqno,
+			    fences[n - 1]->seqno, fences[i]->ops))
+				swap(fences[n - 1], fences[i]);
+			dma_fence_put(fences[i]);
+			continue;
+		}
+		fences[n++] = fences[i];
+	}
+	b->num_fences = n;
+
+	if (n == 0) {
+		fence = NULL;
+	} else if (n == 1) {
+		fence = fences[0];
+	} else {
+		array = dma_fence_array_alloc(n, true);
+		array->num_fences = n;
+		memcpy(dma_fence_array_inline_fences(array), fences,
+		    n * sizeof(*fences));
+		dma_fence_array_init(array, n,
+		    dma_fence_array_inline_fences(array), context, seqno,
+		    false);
+		fence = &array->base;
+	}
+
+	b->num_fences = 0;
+	dma_fence_array_builder_fini(b);
+	return (fence);
+}
+EXPORT_SYMBOL(dma_fence_array_builder_finish);
+
+/**
+ * dma_fence_array_builder_fini - drop everything collected by a builder
+ * @b: the builder
+ */
+void
+dma_fence_array_builder_fini(struct dma_fence_array_builder *b)
+{
+	unsigned int i;
+
+	for (i = 0; i < b->num_fences; i++)
+		dma_fence_put(b->fences[i]);
+	if (b->fences != b->inline_fences)
+		free(b->fences, M_DMABUF);
+	dma_fence_array_builder_init(b);
+}
+EXPORT_SYMBOL(dma_fence_array_builder_fini);
 #endif /* BSDTNG */
 
 #ifndef BSDTNG
@@ -301,3 +549,26 @@ to_dma_fence_array(struct dma_fence *fence)
 	return (container_of(fence, struct dma_fence_array, base));
 }
 #endif
+
+static void
+dma_fence_array_zone_init(void *arg __unused)
+{
+
+	dma_fence_array_zone = uma_zcreate("dma_fence_array",
+	    dma_fence_array_size(DMA_FENCE_ARRAY_ZONE_FENCES, true),
+	    NULL, NULL, NULL, NULL, UMA_ALIGN_PTR, 0);
+}
+
+static void
+dma_fence_array_zone_uninit(void *arg __unused)
+{
+
+	/* Wait for arrays still queued by dma_fence_array_release(). */
+	rcu_barrier();
+	uma_zdestroy(dma_fence_array_zone);
+}
+
+SYSINIT(dma_fence_array, SI_SUB_DRIVERS, SI_ORDER_SECOND,
+    dma_fence_array_zone_init, NULL);
+SYSUNINIT(dma_fence_array, SI_SUB_DRIVERS, SI_ORDER_SECOND,
+    dma_fence_array_zone_uninit, NULL);
@@ -25,6 +25,9 @@
  */
 
 #include <sys/param.h>
+#include <sys/kernel.h>
+
+#include <vm/uma.h>
 
 #include <linux/dma-fence-chain.h>
 
@@ -32,6 +35,121 @@ static bool dma_fence_chain_enable_signaling(struct dma_fence *fence);
 
 MALLOC_DECLARE(M_DMABUF);
 
+/* Timeline signaling allocates a chain node per point, keep them in a zone. */
+static uma_zone_t dma_fence_chain_zone;
+
+/*
+ * Points of one timeline are kept in a tree sorted by seqno so that
+ * dma_fence_chain_find_seqno() does not have to walk the whole chain.
+ * The tree only holds weak references: a point removes itself from the
+ * index in its release callback, so pruning in dma_fence_chain_walk()
+ * and dma_fence_chain_release() work exactly as before.
+ *
+ * Only the point that is currently the newest one (the tip) may be
+ * extended into the same index. Building on an older point creates a
+ * branch which gets its own index, so every index stays a linear
+ * history and any point in it below a head is an ancestor of that head.
+ */
+struct dma_fence_chain_index {
+	spinlock_t lock;
+	struct rb_root root;
+	struct dma_fence_chain *tip;
+	struct kref ref;
+};
+
+static void
+dma_fence_chain_index_free(struct kref *ref)
+{
+	struct dma_fence_chain_index *index;
+
+	index = container_of(ref, typeof(*index), ref);
+	free(index, M_DMABUF);
+}
+
+static void
+dma_fence_chain_index_add(struct dma_fence_chain *chain,
+    struct dma_fence_chain *prev_chain)
+{
+	struct dma_fence_chain_index *index;
+	unsigned long flags;
+
+	if (prev_chain != NULL && (index = prev_chain->index) != NULL) {
+		spin_lock_irqsave(&index->lock, flags);
+		if (index->tip == prev_chain) {
+			/* The tip is the rightmost node, append after it. */
+			kref_get(&index->ref);
+			rb_link_node(&chain->index_node, &prev_chain->index_node,
+			    &prev_chain->index_node.rb_right);
+			rb_insert_color(&chain->index_node, &index->root);
+			index->tip = chain;
+			chain->index = index;
+			spin_unlock_irqrestore(&index->lock, flags);
+			return;
+		}
+		spin_unlock_irqrestore(&index->lock, flags);
+	}
+
+	/* The index is only an accelerator, lookups fall back to walking. */
+	index = malloc(sizeof(*index), M_DMABUF, M_NOWAIT | M_ZERO);
+	if (index == NULL)
+		return;
+	spin_lock_init(&index->lock);
+	index->root = RB_ROOT;
+	kref_init(&index->ref);
+	rb_link_node(&chain->index_node, NULL, &index->root.rb_node);
+	rb_insert_color(&chain->index_node, &index->root);
+	index->tip = chain;
+	chain->index = index;
+}
+
+static void
+dma_fence_chain_index_remove(struct dma_fence_chain *chain)
+{
+	struct dma_fence_chain_index *index;
+	unsigned long flags;
+
+	if ((index = chain->index) == NULL)
+		return;
+	spin_lock_irqsave(&index->lock, flags);
+	rb_erase(&chain->index_node, &index->root);
+	if (index->tip == chain)
+		index->tip = NULL;
+	spin_unlock_irqrestore(&index->lock, flags);
+	chain->index = NULL;
+	kref_put(&index->ref, dma_fence_chain_index_free);
+}
+
+/*
+ * Return a reference to the oldest indexed point of the timeline whose
+ * seqno is at least @seqno, or NULL if it could not be found.
+ */
+static struct dma_fence *
+dma_fence_chain_index_find(struct dma_fence_chain_index *index,
+    uint64_t seqno)
+{
+	struct dma_fence_chain *chain, *found;
+	struct rb_node *rb;
+	unsigned long flags;
+
+	found = NULL;
+	spin_lock_irqsave(&index->lock, flags);
+	rb = index->root.rb_node;
+	while (rb != NULL) {
+		chain = rb_entry(rb, struct dma_fence_chain, index_node);
+		if (chain->base.seqno >= seqno) {
+			found = chain;
+			rb = rb->rb_left;
+		} else
+			rb = rb->rb_right;
+	}
+	/* A point that is already being released is still in the tree. */
+	if (found != NULL && kref_get_unless_zero(&found->base.refcount) == 0)
+		found = NULL;
+	spin_unlock_irqrestore(&index->lock, flags);
+
+	return (found != NULL ? &found->base : NULL);
+}
+
 static const char *
 dma_fence_chain_get_driver_name(struct dma_fence *fence)
 {
@@ -110,6 +228,25 @@ dma_fence_chain_signaled(struct dma_fence *fence)
 	return (true);
 }
 
+static void
+dma_fence_chain_set_deadline(struct dma_fence *fence, ktime_t deadline)
+{
+	struct dma_fence *iter;
+
+	dma_fence_chain_for_each(iter, fence)
+		dma_fence_set_deadline(dma_fence_chain_contained(iter),
+		    deadline);
+}
+
+static void
+dma_fence_chain_free_rcu(struct rcu_head *rcu)
+{
+	struct dma_fence *fence;
+
+	fence = container_of(rcu, struct dma_fence, rcu);
+	dma_fence_chain_free(to_dma_fence_chain(fence));
+}
+
 static void
 dma_fence_chain_release(struct dma_fence *fence)
 {
@@ -117,6 +254,7 @@ dma_fence_chain_release(struct dma_fence *fence)
 	struct dma_fence *prev;
 	
 	chain = to_dma_fence_chain(fence);
+	dma_fence_chain_index_remove(chain);
 	while ((prev = rcu_dereference_protected(chain->prev, true)) != NULL) {
 		if (kref_read(&prev->refcount) > 1)
 			break;
@@ -128,7 +266,7 @@ dma_fence_chain_release(struct dma_fence *fence)
 	}
 	dma_fence_put(prev);
 	dma_fence_put(chain->fence);
-	dma_fence_free(fence);
+	call_rcu(&fence->rcu, dma_fence_chain_free_rcu);
 }
 
 const struct dma_fence_ops dma_fence_chain_ops = {
@@ -138,8 +276,37 @@ const struct dma_fence_ops dma_fence_chain_ops = {
 	.enable_signaling = dma_fence_chain_enable_signaling,
 	.signaled = dma_fence_chain_signaled,
 	.release = dma_fence_chain_release,
+	.set_deadline = dma_fence_chain_set_deadline,
 };
 
+/**
+ * dma_fence_chain_alloc
+ *
+ * Returns a new struct dma_fence_chain object or NULL on failure.
+ */
+struct dma_fence_chain *
+dma_fence_chain_alloc(void)
+{
+
+	return (uma_zalloc(dma_fence_chain_zone, M_WAITOK | M_ZERO));
+}
+
+/**
+ * dma_fence_chain_free
+ * @chain: chain node to free
+ *
+ * Frees up an allocated but not used struct dma_fence_chain object. This
+ * doesn't need an RCU grace period since the fence was never initialized nor
+ * published. After dma_fence_chain_init() has been called the fence must be
+ * released by calling dma_fence_put(), and not through this function.
+ */
+void
+dma_fence_chain_free(struct dma_fence_chain *chain)
+{
+
+	uma_zfree(dma_fence_chain_zone, chain);
+}
+
 void
 dma_fence_chain_init(struct dma_fence_chain *chain,
 			  struct dma_fence *prev,
@@ -153,6 +320,7 @@ dma_fence_chain_init(struct dma_fence_chain *chain,
 	init_irq_work(&chain->work, dma_fence_chain_irq_work);
 	chain->fence = fence;
 	chain->prev = prev;
+	chain->index = NULL;
 	prev_chain = to_dma_fence_chain(prev);
 	if (prev_chain != NULL &&
 	    __dma_fence_is_later(seqno, prev->seqno, prev->ops)) {
@@ -162,10 +330,12 @@ dma_fence_chain_init(struct dma_fence_chain *chain,
 		if (prev_chain != NULL)
 			seqno = max(prev->seqno, seqno);
 		context = dma_fence_context_alloc(1);
+		prev_chain = NULL;
 	}
 
 	dma_fence_init(&chain->base, &dma_fence_chain_ops,
 	    &chain->lock, context, seqno);
+	dma_fence_chain_index_add(chain, prev_chain);
 }
 
 int
@@ -179,6 +349,20 @@ dma_fence_chain_find_seqno(struct dma_fence **fence, uint64_t seqno)
 		return (-EINVAL);
 	if (chain->base.seqno < seqno)
 		return (-EINVAL);
+	/*
+	 * The index only knows the points still alive, once the point for
+	 * @seqno is pruned it returns a later one. That one is only the answer
+	 * if the timeline never had a point at @seqno, otherwise walk.
+	 */
+	if (chain->index != NULL &&
+	    (*fence = dma_fence_chain_index_find(chain->index, seqno)) != NULL) {
+		if ((*fence)->seqno == seqno ||
+		    to_dma_fence_chain(*fence)->prev_seqno < seqno) {
+			dma_fence_put(&chain->base);
+			return (0);
+		}
+		dma_fence_put(*fence);
+	}
 	dma_fence_chain_for_each(*fence, &chain->base) {
 		if ((*fence)->context != chain->base.context)
 			break;
@@ -232,4 +416,27 @@ to_dma_fence_chain(struct dma_fence *fence)
 
 	return (container_of(fence, struct dma_fence_chain, base));
 }
-#endif
\ No newline at end of file
+#endif
+
+static void
+dma_fence_chain_zone_init(void *arg __unused)
+{
+
+	dma_fence_chain_zone = uma_zcreate("dma_fence_chain",
+	    sizeof(struct dma_fence_chain), NULL, NULL, NULL, NULL,
+	    UMA_ALIGN_PTR, 0);
+}
+
+static void
+dma_fence_chain_zone_uninit(void *arg __unused)
+{
+
+	/* Wait for chain nodes still queued by dma_fence_chain_release(). */
+	rcu_barrier();
+	uma_zdestroy(dma_fence_chain_zone);
+}
+
+SYSINIT(dma_fence_chain, SI_SUB_DRIVERS, SI_ORDER_SECOND,
+    dma_fence_chain_zone_init, NULL);
+SYSUNINIT(dma_fence_chain, SI_SUB_DRIVERS, SI_ORDER_SECOND,
+    dma_fence_chain_zone_uninit, NULL);
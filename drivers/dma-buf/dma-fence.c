@@ -24,7 +24,17 @@
  *
  */
 
+#include <sys/param.h>
+#include <sys/kernel.h>
+#include <sys/sbuf.h>
+#include <sys/sysctl.h>
+
 #include <linux/dma-fence.h>
+#include <linux/ktime.h>
+#include <linux/seq_file.h>
+#ifdef CONFIG_DEBUG_FS
+#include <linux/debugfs.h>
+#endif
 #ifdef BSDTNG
 #include <linux/export.h>
 #endif
@@ -267,6 +277,240 @@ void __dma_fence_might_wait(void)
 #endif /* BSDTNG */
 #endif
 
+/*
+ * Latency statistics.
+ *
+ * With hw.dmabuf.fence_stats set, dma_fence_init() stamps every fence and the
+ * core keeps three log2 histograms per &dma_fence_ops: time from init to
+ * signal, time spent in each signal callback, and how long a sleeper in
+ * dma_fence_default_wait() took to run again after the fence signaled.  The
+ * histograms are printed by the hw.dmabuf.fence_latency sysctl and by
+ * dma_buf/fence_stats in debugfs, one line per non-empty bucket giving its
+ * lower bound.  With the knob clear the hot paths only test one integer.
+ */
+#define	DMA_FENCE_STATS_SLOTS	32	/* the last one collects the overflow */
+#define	DMA_FENCE_STATS_BUCKETS	40	/* 2^39ns, about 9 minutes */
+
+enum {
+	DMA_FENCE_STATS_SIGNAL,
+	DMA_FENCE_STATS_CALLBACK,
+	DMA_FENCE_STATS_WAKE,
+	DMA_FENCE_STATS_NHIST
+};
+
+static const char *dma_fence_stats_hist_names[DMA_FENCE_STATS_NHIST] = {
+	[DMA_FENCE_STATS_SIGNAL] = "init to signal",
+	[DMA_FENCE_STATS_CALLBACK] = "callback",
+	[DMA_FENCE_STATS_WAKE] = "waiter wake",
+};
+
+struct dma_fence_hist {
+	atomic64_t count;
+	atomic64_t sum_ns;
+	atomic64_t max_ns;
+	atomic64_t bucket[DMA_FENCE_STATS_BUCKETS];
+};
+
+struct dma_fence_stats {
+	const struct dma_fence_ops *ops;
+	char driver[32];
+	struct dma_fence_hist hist[DMA_FENCE_STATS_NHIST];
+};
+
+static int dma_fence_stats_enabled;
+static struct dma_fence_stats dma_fence_stats_slots[DMA_FENCE_STATS_SLOTS];
+static DEFINE_SPINLOCK(dma_fence_stats_lock);
+
+SYSCTL_DECL(_hw_dmabuf);
+SYSCTL_INT(_hw_dmabuf, OID_AUTO, fence_stats, CTLFLAG_RWTUN,
+    &dma_fence_stats_enabled, 0,
+    "Collect dma_fence latency histograms");
+
+#define	dma_fence_stats_active()	\
+	__predict_false(READ_ONCE(dma_fence_stats_enabled) != 0)
+
+/*
+ * find the statistics slot of the fence ops, claiming a free one if needed
+ */
+static struct dma_fence_stats *
+dma_fence_stats_lookup(struct dma_fence *fence)
+{
+	const struct dma_fence_ops *ops = fence->ops;
+	struct dma_fence_stats *st;
+	int i;
+
+	for (i = 0; i < DMA_FENCE_STATS_SLOTS - 1; i++) {
+		st = &dma_fence_stats_slots[i];
+		if (smp_load_acquire(&st->ops) == ops)
+			return (st);
+		if (st->ops == NULL)
+			break;
+	}
+	if (ops == NULL || i == DMA_FENCE_STATS_SLOTS - 1)
+		return (&dma_fence_stats_slots[DMA_FENCE_STATS_SLOTS - 1]);
+
+	spin_lock(&dma_fence_stats_lock);
+	for (; i < DMA_FENCE_STATS_SLOTS - 1; i++) {
+		st = &dma_fence_stats_slots[i];
+		if (st->ops == ops)
+			break;
+		if (st->ops == NULL) {
+			strlcpy(st->driver, ops->get_driver_name(fence),
+			    sizeof(st->driver));
+			smp_store_release(&st->ops, ops);
+			break;
+		}
+	}
+	if (i == DMA_FENCE_STATS_SLOTS - 1)
+		st = &dma_fence_stats_slots[i];
+	spin_unlock(&dma_fence_stats_lock);
+	return (st);
+}
+
+static void
+dma_fence_hist_add(struct dma_fence_hist *h, s64 ns)
+{
+	s64 max, old;
+	int b;
+
+	if (ns < 0)
+		ns = 0;
+	b = ns != 0 ? min(fls64(ns), DMA_FENCE_STATS_BUCKETS) - 1 : 0;
+
+	atomic64_inc(&h->count);
+	atomic64_add(ns, &h->sum_ns);
+	atomic64_inc(&h->bucket[b]);
+	for (max = atomic64_read(&h->max_ns); ns > max; max = old) {
+		old = atomic64_cmpxchg(&h->max_ns, max, ns);
+		if (old == max)
+			break;
+	}
+}
+
+static void
+dma_fence_stats_reset(void)
+{
+	struct dma_fence_hist *h;
+	int i, j, b;
+
+	for (i = 0; i < DMA_FENCE_STATS_SLOTS; i++) {
+		for (j = 0; j < DMA_FENCE_STATS_NHIST; j++) {
+			h = &dma_fence_stats_slots[i].hist[j];
+			atomic64_set(&h->count, 0);
+			atomic64_set(&h->sum_ns, 0);
+			atomic64_set(&h->max_ns, 0);
+			for (b = 0; b < DMA_FENCE_STATS_BUCKETS; b++)
+				atomic64_set(&h->bucket[b], 0);
+		}
+	}
+}
+
+static int
+dma_fence_stats_show(struct seq_file *m, void *unused)
+{
+	struct dma_fence_stats *st;
+	struct dma_fence_hist *h;
+	const char *driver;
+	s64 count, n;
+	int i, j, b;
+
+	for (i = 0; i < DMA_FENCE_STATS_SLOTS; i++) {
+		st = &dma_fence_stats_slots[i];
+		if (i < DMA_FENCE_STATS_SLOTS - 1) {
+			if (smp_load_acquire(&st->ops) == NULL)
+				break;
+			driver = st->driver;
+		} else
+			driver = "(other)";
+
+		for (j = 0; j < DMA_FENCE_STATS_NHIST; j++) {
+			h = &st->hist[j];
+			count = atomic64_read(&h->count);
+			if (count == 0)
+				continue;
+			/* The slot tells apart several ops of one driver. */
+			seq_printf(m,
+			    "%s/%d %s: count %lld avg %lldns max %lldns\n",
+			    driver, i, dma_fence_stats_hist_names[j],
+			    (long long)count,
+			    (long long)(atomic64_read(&h->sum_ns) / count),
+			    (long long)atomic64_read(&h->max_ns));
+			for (b = 0; b < DMA_FENCE_STATS_BUCKETS; b++) {
+				n = atomic64_read(&h->bucket[b]);
+				if (n == 0)
+					continue;
+				seq_printf(m, "\t%20llu ns: %lld\n",
+				    1ULL << b, (long long)n);
+			}
+		}
+	}
+	return (0);
+}
+
+static int
+dma_fence_stats_sysctl(SYSCTL_HANDLER_ARGS)
+{
+	struct seq_file m = {};
+	struct sbuf sb;
+	int error;
+
+	sbuf_new_for_sysctl(&sb, NULL, 256, req);
+	sbuf_putc(&sb, '\n');
+	m.buf = &sb;
+	dma_fence_stats_show(&m, NULL);
+	error = sbuf_finish(&sb);
+	sbuf_delete(&sb);
+	return (error);
+}
+SYSCTL_PROC(_hw_dmabuf, OID_AUTO, fence_latency,
+    CTLTYPE_STRING | CTLFLAG_RD | CTLFLAG_MPSAFE, NULL, 0,
+    dma_fence_stats_sysctl, "A",
+    "dma_fence latency histograms per fence ops, in log2 ns buckets");
+
+static int
+dma_fence_stats_reset_sysctl(SYSCTL_HANDLER_ARGS)
+{
+	int error, val;
+
+	val = 0;
+	error = sysctl_handle_int(oidp, &val, 0, req);
+	if (error != 0 || req->newptr == NULL)
+		return (error);
+	if (val != 0)
+		dma_fence_stats_reset();
+	return (0);
+}
+SYSCTL_PROC(_hw_dmabuf, OID_AUTO, fence_stats_reset,
+    CTLTYPE_INT | CTLFLAG_RW | CTLFLAG_MPSAFE, NULL, 0,
+    dma_fence_stats_reset_sysctl, "I",
+    "Write a non-zero value to clear the dma_fence latency histograms");
+
+#ifdef CONFIG_DEBUG_FS
+DEFINE_SHOW_ATTRIBUTE(dma_fence_stats);
+
+static struct dentry *dma_fence_debugfs_root;
+
+static void
+dma_fence_stats_init(void *arg __unused)
+{
+
+	dma_fence_debugfs_root = debugfs_create_dir("dma_buf", NULL);
+	debugfs_create_file("fence_stats", 0444, dma_fence_debugfs_root,
+	    NULL, &dma_fence_stats_fops);
+}
+
+static void
+dma_fence_stats_uninit(void *arg __unused)
+{
+
+	debugfs_remove_recursive(dma_fence_debugfs_root);
+}
+SYSINIT(dma_fence_stats, SI_SUB_DRIVERS, SI_ORDER_SECOND,
+    dma_fence_stats_init, NULL);
+SYSUNINIT(dma_fence_stats, SI_SUB_DRIVERS, SI_ORDER_SECOND,
+    dma_fence_stats_uninit, NULL);
+#endif
+
 /*
  * signal completion of a fence
  */
@@ -275,7 +519,9 @@ dma_fence_signal_timestamp_locked(struct dma_fence *fence,
 				  ktime_t timestamp)
 {
 	struct dma_fence_cb *cur, *tmp;
+	struct dma_fence_stats *st;
 	struct list_head cb_list;
+	ktime_t start;
 
 	if (fence == NULL)
 		return (-EINVAL);
@@ -288,9 +534,24 @@ dma_fence_signal_timestamp_locked(struct dma_fence *fence,
 	fence->timestamp = timestamp;
 	set_bit(DMA_FENCE_FLAG_TIMESTAMP_BIT, &fence->flags);
 
+	st = NULL;
+	if (dma_fence_stats_active()) {
+		st = dma_fence_stats_lookup(fence);
+		if (fence->stats_start != 0)
+			dma_fence_hist_add(&st->hist[DMA_FENCE_STATS_SIGNAL],
+			    ktime_to_ns(ktime_sub(timestamp,
+			    fence->stats_start)));
+	}
+
 	list_for_each_entry_safe(cur, tmp, &cb_list, node) {
 		INIT_LIST_HEAD(&cur->node);
-		cur->func(fence, cur);
+		if (__predict_false(st != NULL)) {
+			start = ktime_get();
+			cur->func(fence, cur);
+			dma_fence_hist_add(&st->hist[DMA_FENCE_STATS_CALLBACK],
+			    ktime_to_ns(ktime_sub(ktime_get(), start)));
+		} else
+			cur->func(fence, cur);
 	}
 
 	return (0);
@@ -460,6 +721,19 @@ dma_fence_enable_sw_signaling(struct dma_fence *fence)
 	spin_unlock(fence->lock);
 }
 
+/*
+ * tell the producer of a fence that a consumer needs it signaled by the
+ * deadline, an absolute CLOCK_MONOTONIC time
+ */
+void
+dma_fence_set_deadline(struct dma_fence *fence, ktime_t deadline)
+{
+
+	if (fence->ops && fence->ops->set_deadline != NULL &&
+	    !dma_fence_is_signaled(fence))
+		fence->ops->set_deadline(fence, deadline);
+}
+
 /*
  * add a callback to be called when the fence is signaled
  */
@@ -561,6 +835,7 @@ dma_fence_default_wait(struct dma_fence *fence, bool intr, signed long timeout)
 {
 	struct default_wait_cb cb;
 	signed long rv = timeout ? timeout : 1;
+	bool slept = false;
 
 #ifndef BSDTNG
 	bool was_enabled;
@@ -612,6 +887,7 @@ dma_fence_default_wait(struct dma_fence *fence, bool intr, signed long timeout)
 		spin_unlock(fence->lock);
 
 		rv = schedule_timeout(rv);
+		slept = true;
 
 		spin_lock(fence->lock);
 		if (rv > 0 && intr && signal_pending(current))
@@ -622,6 +898,12 @@ dma_fence_default_wait(struct dma_fence *fence, bool intr, signed long timeout)
 		list_del(&cb.base.node);
 	__set_current_state(TASK_RUNNING);
 
+	if (slept && dma_fence_stats_active() &&
+	    test_bit(DMA_FENCE_FLAG_TIMESTAMP_BIT, &fence->flags))
+		dma_fence_hist_add(
+		    &dma_fence_stats_lookup(fence)->hist[DMA_FENCE_STATS_WAKE],
+		    ktime_to_ns(ktime_sub(ktime_get(), fence->timestamp)));
+
 out:
 	spin_unlock(fence->lock);
 	return (rv);
@@ -744,6 +1026,7 @@ dma_fence_init(struct dma_fence *fence, const struct dma_fence_ops *ops,
 	fence->seqno = seqno;
 	fence->flags = 0;
 	fence->error = 0;
+	fence->stats_start = dma_fence_stats_active() ? ktime_get() : 0;
 }
 
 /*
@@ -33,6 +33,13 @@
  * Authors: Thomas Hellstrom <thellstrom-at-vmware-dot-com>
  */
 
+#ifdef __FreeBSD__
+#include <sys/types.h>
+#include <sys/counter.h>
+#include <sys/kernel.h>
+#include <sys/sysctl.h>
+#endif
+
 #include <linux/dma-resv.h>
 #include <linux/dma-fence-array.h>
 #include <linux/export.h>
@@ -55,6 +62,34 @@
 DEFINE_WW_CLASS(reservation_ww_class);
 EXPORT_SYMBOL(reservation_ww_class);
 
+#if defined(__FreeBSD__) && defined(BSDTNG)
+SYSCTL_DECL(_hw_dmabuf);
+
+static COUNTER_U64_DEFINE_EARLY(dma_resv_promotions);
+SYSCTL_COUNTER_U64(_hw_dmabuf, OID_AUTO, resv_promotions, CTLFLAG_RD,
+    &dma_resv_promotions,
+    "Reservation objects which outgrew their inline fence storage");
+
+static COUNTER_U64_DEFINE_EARLY(dma_resv_list_grows);
+SYSCTL_COUNTER_U64(_hw_dmabuf, OID_AUTO, resv_list_grows, CTLFLAG_RD,
+    &dma_resv_list_grows,
+    "Fence lists reallocated to a larger size");
+
+static COUNTER_U64_DEFINE_EARLY(dma_resv_list_shrinks);
+SYSCTL_COUNTER_U64(_hw_dmabuf, OID_AUTO, resv_list_shrinks, CTLFLAG_RD,
+    &dma_resv_list_shrinks,
+    "Fence lists reallocated to a smaller size");
+
+static COUNTER_U64_DEFINE_EARLY(dma_resv_compacted);
+SYSCTL_COUNTER_U64(_hw_dmabuf, OID_AUTO, resv_compacted, CTLFLAG_RD,
+    &dma_resv_compacted,
+    "Signaled fences removed from fence lists in place");
+
+#define dma_resv_count(c, n)	counter_u64_add(c, n)
+#else
+#define dma_resv_count(c, n)	do { } while (0)
+#endif
+
 
 #ifdef BSDTNG
 /* Mask for the lower fence pointer bits */
@@ -118,13 +153,31 @@ static struct dma_resv_list *dma_resv_list_alloc(unsigned int shared_max)
 	return list;
 }
 
+#ifdef BSDTNG
+static inline bool dma_resv_list_is_inline(struct dma_resv *obj,
+					   struct dma_resv_list *list)
+{
+	return list == (struct dma_resv_list *)&obj->inline_fences;
+}
+
+/*
+ * Stop using the inline storage of @obj. RCU readers may still be walking it,
+ * so it is never handed out again once it has been replaced.
+ */
+static inline void dma_resv_inline_retire(struct dma_resv *obj)
+{
+	obj->inline_fences.max_fences = 0;
+}
+#endif
+
 /**
  * dma_resv_list_free - free fence list
+ * @obj: the reservation object the list belongs to
  * @list: list to free
  *
  * Free a dma_resv_list and make sure to drop all references.
  */
-static void dma_resv_list_free(struct dma_resv_list *list)
+static void dma_resv_list_free(struct dma_resv *obj, struct dma_resv_list *list)
 {
 	unsigned int i;
 
@@ -141,6 +194,11 @@ static void dma_resv_list_free(struct dma_resv_list *list)
 		dma_resv_list_entry(list, i, NULL, &fence, NULL);
 		dma_fence_put(fence);
 	}
+
+	if (dma_resv_list_is_inline(obj, list)) {
+		dma_resv_inline_retire(obj);
+		return;
+	}
 #endif
 
 	kfree_rcu(list, rcu);
@@ -161,6 +219,12 @@ void dma_resv_init(struct dma_resv *obj)
 	RCU_INIT_POINTER(obj->fences, NULL);
 #ifndef BSDTNG
 	RCU_INIT_POINTER(obj->fence_excl, NULL);
+#else
+	BUILD_BUG_ON(offsetof(struct dma_resv_inline_list, table) !=
+		     offsetof(struct dma_resv_list, table));
+	obj->inline_fences.num_fences = 0;
+	obj->inline_fences.max_fences = DMA_RESV_INLINE_FENCES;
+	obj->fences_hwm = 0;
 #endif
 }
 EXPORT_SYMBOL(dma_resv_init);
@@ -187,7 +251,7 @@ void dma_resv_fini(struct dma_resv *obj)
 #endif
 
 	fobj = rcu_dereference_protected(obj->fences, 1);
-	dma_resv_list_free(fobj);
+	dma_resv_list_free(obj, fobj);
 #ifdef __FreeBSD__
 	rw_destroy(&obj->rw);
 #endif
@@ -202,6 +266,55 @@ static inline struct dma_resv_list *dma_resv_fences_list(struct dma_resv *obj)
 	return rcu_dereference_check(obj->fences, dma_resv_held(obj));
 }
 
+/*
+ * Move the signaled fences of @list behind the unsignaled ones and drop them,
+ * so that nobody has to walk them anymore. Unlocked readers could see entries
+ * move, so the update is done under @obj->seq which makes them restart.
+ */
+static void dma_resv_list_compact(struct dma_resv *obj,
+				  struct dma_resv_list *list)
+{
+	struct dma_fence *fence, *tmp;
+	unsigned int i, j, count;
+	bool signaled = false;
+
+	/* Polling the fences can sleep, do it before entering the seqcount. */
+	count = list->num_fences;
+	for (i = 0; i < count; ++i) {
+		dma_resv_list_entry(list, i, obj, &fence, NULL);
+		signaled |= dma_fence_is_signaled(fence);
+	}
+	if (!signaled)
+		return;
+
+	preempt_disable();
+	write_seqcount_begin(&obj->seq);
+	for (i = 0, j = 0; i < count; ++i) {
+		dma_resv_list_entry(list, i, obj, &fence, NULL);
+		if (test_bit(DMA_FENCE_FLAG_SIGNALED_BIT, &fence->flags))
+			continue;
+
+		if (i != j) {
+			tmp = rcu_dereference_protected(list->table[i],
+							dma_resv_held(obj));
+			RCU_INIT_POINTER(list->table[i],
+					 rcu_dereference_protected(list->table[j],
+					     dma_resv_held(obj)));
+			RCU_INIT_POINTER(list->table[j], tmp);
+		}
+		j++;
+	}
+	list->num_fences = j;
+	write_seqcount_end(&obj->seq);
+	preempt_enable();
+
+	for (i = j; i < count; ++i) {
+		dma_resv_list_entry(list, i, obj, &fence, NULL);
+		dma_fence_put(fence);
+	}
+	dma_resv_count(dma_resv_compacted, count - j);
+}
+
 /**
  * dma_resv_reserve_fences - Reserve space to add fences to a dma_resv object.
  * @obj: reservation object
@@ -221,14 +334,39 @@ int dma_resv_reserve_fences(struct dma_resv *obj, unsigned int num_fences)
 {
 	struct dma_resv_list *old, *new;
 	unsigned int i, j, k, max;
+	bool shrink = false;
 
 	dma_resv_assert_held(obj);
 
 	old = dma_resv_fences_list(obj);
 	if (old && old->max_fences) {
-		if ((old->num_fences + num_fences) <= old->max_fences)
-			return 0;
-		max = max(old->num_fences + num_fences, old->max_fences * 2);
+		/*
+		 * Reclaim the slots of signaled fences before growing. Not
+		 * while there is room, every compaction polls all the fences
+		 * and restarts the unlocked readers.
+		 */
+		if ((old->num_fences + num_fences) > old->max_fences)
+			dma_resv_list_compact(obj, old);
+		obj->fences_hwm = max(old->num_fences + num_fences,
+				      obj->fences_hwm - obj->fences_hwm / 8);
+		if ((old->num_fences + num_fences) <= old->max_fences) {
+			/* Give the slots of an earlier burst back */
+			if (dma_resv_list_is_inline(obj, old) ||
+			    old->max_fences < 4 * max(obj->fences_hwm, 4u))
+				return 0;
+			max = roundup_pow_of_two(2 * max(obj->fences_hwm, 4u));
+			shrink = true;
+		} else {
+			max = max(old->num_fences + num_fences,
+				  old->max_fences * 2);
+		}
+	} else if (!old && obj->inline_fences.max_fences &&
+		   num_fences <= obj->inline_fences.max_fences) {
+		/* Small enough for the storage embedded in the object */
+		obj->inline_fences.num_fences = 0;
+		rcu_assign_pointer(obj->fences,
+				   (struct dma_resv_list *)&obj->inline_fences);
+		return 0;
 	} else {
 		max = max(4ul, roundup_pow_of_two(num_fences));
 	}
@@ -276,7 +414,17 @@ int dma_resv_reserve_fences(struct dma_resv *obj, unsigned int num_fences)
 						  dma_resv_held(obj));
 		dma_fence_put(fence);
 	}
-	kfree_rcu(old, rcu);
+
+	if (dma_resv_list_is_inline(obj, old)) {
+		dma_resv_inline_retire(obj);
+		dma_resv_count(dma_resv_promotions, 1);
+	} else {
+		kfree_rcu(old, rcu);
+		if (shrink)
+			dma_resv_count(dma_resv_list_shrinks, 1);
+		else
+			dma_resv_count(dma_resv_list_grows, 1);
+	}
 
 	return 0;
 }
@@ -353,6 +501,7 @@ void dma_resv_add_fence(struct dma_resv *obj, struct dma_fence *fence,
 	dma_resv_list_set(fobj, i, fence, usage);
 	/* pointer update must be visible before we extend the num_fences */
 	smp_store_mb(fobj->num_fences, count);
+	obj->fences_hwm = max(obj->fences_hwm, count);
 }
 EXPORT_SYMBOL(dma_resv_add_fence);
 
@@ -398,6 +547,7 @@ static void dma_resv_iter_restart_unlocked(struct dma_resv_iter *cursor)
 {
 	cursor->index = 0;
 	cursor->num_fences = 0;
+	cursor->seq = read_seqcount_begin(&cursor->obj->seq);
 	cursor->fences = dma_resv_fences_list(cursor->obj);
 	if (cursor->fences)
 		cursor->num_fences = cursor->fences->num_fences;
@@ -435,6 +585,13 @@ static void dma_resv_iter_walk_unlocked(struct dma_resv_iter *cursor)
 	} while (true);
 }
 
+/* Check if the fences were replaced or compacted under an unlocked cursor. */
+static bool dma_resv_iter_changed(struct dma_resv_iter *cursor)
+{
+	return dma_resv_fences_list(cursor->obj) != cursor->fences ||
+	       read_seqcount_retry(&cursor->obj->seq, cursor->seq);
+}
+
 /**
  * dma_resv_iter_first_unlocked - first fence in an unlocked dma_resv obj.
  * @cursor: the cursor with the current position
@@ -453,7 +610,7 @@ struct dma_fence *dma_resv_iter_first_unlocked(struct dma_resv_iter *cursor)
 	do {
 		dma_resv_iter_restart_unlocked(cursor);
 		dma_resv_iter_walk_unlocked(cursor);
-	} while (dma_resv_fences_list(cursor->obj) != cursor->fences);
+	} while (dma_resv_iter_changed(cursor));
 	rcu_read_unlock();
 
 	return cursor->fence;
@@ -476,13 +633,13 @@ struct dma_fence *dma_resv_iter_next_unlocked(struct dma_resv_iter *cursor)
 
 	rcu_read_lock();
 	cursor->is_restarted = false;
-	restart = dma_resv_fences_list(cursor->obj) != cursor->fences;
+	restart = dma_resv_iter_changed(cursor);
 	do {
 		if (restart)
 			dma_resv_iter_restart_unlocked(cursor);
 		dma_resv_iter_walk_unlocked(cursor);
 		restart = true;
-	} while (dma_resv_fences_list(cursor->obj) != cursor->fences);
+	} while (dma_resv_iter_changed(cursor));
 	rcu_read_unlock();
 
 	return cursor->fence;
@@ -563,7 +720,7 @@ int dma_resv_copy_fences(struct dma_resv *dst, struct dma_resv *src)
 	dma_resv_for_each_fence_unlocked(&cursor, f) {
 
 		if (dma_resv_iter_is_restarted(&cursor)) {
-			dma_resv_list_free(list);
+			dma_resv_list_free(dst, list);
 
 			list = dma_resv_list_alloc(cursor.num_fences);
 			if (!list) {
@@ -580,7 +737,7 @@ int dma_resv_copy_fences(struct dma_resv *dst, struct dma_resv *src)
 	dma_resv_iter_end(&cursor);
 
 	list = rcu_replace_pointer(dst->fences, list, dma_resv_held(dst));
-	dma_resv_list_free(list);
+	dma_resv_list_free(dst, list);
 
 #else /* !BSDTNG */
 	struct dma_resv_list *src_list, *dst_list;
@@ -619,7 +776,7 @@ retry:
 				continue;
 
 			if (!dma_fence_get_rcu(fence)) {
-				dma_resv_list_free(dst_list);
+				dma_resv_list_free(dst, dst_list);
 				src_list = rcu_dereference(src->fence);
 				goto retry;
 			}
@@ -661,7 +818,7 @@ retry:
 	rw_wunlock(&dst->rw);
 #endif
 
-	dma_resv_list_free(src_list);
+	dma_resv_list_free(dst, src_list);
 	dma_fence_put(old);
 #endif /* BSDTNG */
 	return 0;
@@ -725,7 +882,8 @@ EXPORT_SYMBOL_GPL(dma_resv_get_fences);
  * @fence: the resulting fence
  *
  * Get a single fence representing all the fences inside the resv object.
- * Returns either 0 for success or -ENOMEM.
+ * Fences which already signaled are left out, so @fence is NULL when there is
+ * nothing left to wait for.
  *
  * Warning: This can't be used like this when adding the fence back to the resv
  * object since that can lead to stack corruption when finalizing the
@@ -736,37 +894,24 @@ EXPORT_SYMBOL_GPL(dma_resv_get_fences);
 int dma_resv_get_singleton(struct dma_resv *obj, enum dma_resv_usage usage,
 			   struct dma_fence **fence)
 {
-	struct dma_fence_array *array;
+	struct dma_fence_array_builder builder;
 	struct dma_fence **fences;
-	unsigned count;
+	unsigned count, i;
 	int r;
 
 	r = dma_resv_get_fences(obj, usage, &count, &fences);
         if (r)
 		return r;
 
-	if (count == 0) {
-		*fence = NULL;
-		return 0;
+	dma_fence_array_builder_init(&builder);
+	for (i = 0; i < count; i++) {
+		dma_fence_array_builder_add(&builder, fences[i]);
+		dma_fence_put(fences[i]);
 	}
+	kfree(fences);
 
-	if (count == 1) {
-		*fence = fences[0];
-		kfree(fences);
-		return 0;
-	}
-
-	array = dma_fence_array_create(count, fences,
-				       dma_fence_context_alloc(1),
-				       1, false);
-	if (!array) {
-		while (count--)
-			dma_fence_put(fences[count]);
-		kfree(fences);
-		return -ENOMEM;
-	}
-
-	*fence = &array->base;
+	*fence = dma_fence_array_builder_finish(&builder,
+						dma_fence_context_alloc(1), 1);
 	return 0;
 }
 EXPORT_SYMBOL_GPL(dma_resv_get_singleton);
@@ -846,8 +991,16 @@ void dma_resv_describe(struct dma_resv *obj, struct seq_file *seq)
 {
 	static const char *usage[] = { "kernel", "write", "read", "bookkeep" };
 	struct dma_resv_iter cursor;
+	struct dma_resv_list *list;
 	struct dma_fence *fence;
 
+	list = dma_resv_fences_list(obj);
+	if (list)
+		seq_printf(seq, "\tfences: %u used, %u slots%s, high-water %u\n",
+			   list->num_fences, list->max_fences,
+			   dma_resv_list_is_inline(obj, list) ? " inline" : "",
+			   obj->fences_hwm);
+
 	dma_resv_for_each_fence(&cursor, obj, DMA_RESV_USAGE_READ, fence) {
 		seq_printf(seq, "\t%s fence:",
 			   usage[dma_resv_iter_usage(&cursor)]);
@@ -0,0 +1,124 @@
+// SPDX-License-Identifier: MIT
+
+/*
+ * Self tests for the dma-buf fence core.
+ *
+ * They need no device, loading the dmabuf_selftests module runs all of them
+ * and the load fails if any test does, so
+ *
+ *	kldload dmabuf_selftests && kldunload dmabuf_selftests
+ *
+ * is all a test run takes.  The module is only built with DMABUF_SELFTESTS
+ * defined.
+ */
+
+#include <sys/param.h>
+#include <sys/kernel.h>
+#include <sys/module.h>
+
+#include <linux/dma-fence.h>
+#include <linux/kernel.h>
+#include <linux/sched.h>
+#include <linux/slab.h>
+#include <linux/spinlock.h>
+
+#include "selftest.h"
+
+static const struct selftest {
+	const char *name;
+	int (*func)(void);
+} selftests[] = {
+#define selftest(n, f) { .name = #n, .func = f },
+#include "selftests.h"
+#undef selftest
+};
+
+static const char *mock_name(struct dma_fence *fence)
+{
+	return "mock";
+}
+
+const struct dma_fence_ops mock_fence_ops = {
+	.get_driver_name = mock_name,
+	.get_timeline_name = mock_name,
+};
+
+static DEFINE_SPINLOCK(mock_fence_lock);
+
+struct dma_fence *alloc_dma_fence(u64 context, u64 seqno)
+{
+	struct dma_fence *dma;
+
+	dma = kmalloc(sizeof(*dma), GFP_KERNEL);
+	if (dma)
+		dma_fence_init(dma, &mock_fence_ops, &mock_fence_lock,
+			       context, seqno);
+
+	return dma;
+}
+
+int __subtests(const char *caller, const struct subtest *st, int count,
+	       void *data)
+{
+	int err;
+
+	for (; count--; st++) {
+		cond_resched();
+
+		pr_info("dma-buf: Running %s/%s\n", caller, st->name);
+		err = st->func(data);
+		if (err) {
+			pr_err("dma-buf/%s: %s failed with error %d\n",
+			       caller, st->name, err);
+			return err;
+		}
+	}
+
+	return 0;
+}
+
+static int run_selftests(void)
+{
+	unsigned int i, failed = 0;
+	int err;
+
+	for (i = 0; i < ARRAY_SIZE(selftests); i++) {
+		pr_info("dma-buf: Running %s\n", selftests[i].name);
+		err = selftests[i].func();
+		if (err) {
+			pr_err("dma-buf: %s failed with error %d\n",
+			       selftests[i].name, err);
+			failed++;
+		}
+	}
+
+	pr_info("dma-buf: %u of %zu selftests failed\n",
+		failed, ARRAY_SIZE(selftests));
+
+	return failed ? -EINVAL : 0;
+}
+
+static int
+dmabuf_selftests_modevent(module_t mod, int type, void *data)
+{
+
+	switch (type) {
+	case MOD_LOAD:
+		return (-run_selftests());
+	case MOD_UNLOAD:
+		return (0);
+	default:
+		return (EOPNOTSUPP);
+	}
+}
+
+static moduledata_t dmabuf_selftests_mod = {
+	"dmabuf_selftests",
+	dmabuf_selftests_modevent,
+	NULL
+};
+DECLARE_MODULE(dmabuf_selftests, dmabuf_selftests_mod, SI_SUB_LAST,
+    SI_ORDER_ANY);
+MODULE_VERSION(dmabuf_selftests, 1);
+MODULE_DEPEND(dmabuf_selftests, dmabuf, 1, 1, 1);
+MODULE_DEPEND(dmabuf_selftests, linuxkpi, 1, 1, 1);
@@ -0,0 +1,34 @@
+/* SPDX-License-Identifier: MIT */
+
+#ifndef __SELFTEST_H__
+#define __SELFTEST_H__
+
+#include <linux/compiler.h>
+#include <linux/types.h>
+
+struct dma_fence;
+struct dma_fence_ops;
+
+#define selftest(name, func) int func(void);
+#include "selftests.h"
+#undef selftest
+
+struct subtest {
+	int (*func)(void *data);
+	const char *name;
+};
+
+int __subtests(const char *caller,
+	       const struct subtest *st,
+	       int count,
+	       void *data);
+#define subtests(T, data) \
+	__subtests(__func__, T, ARRAY_SIZE(T), data)
+
+#define SUBTEST(x) { x, #x }
+
+/* Unsignaled software fences, to be signaled and put by the test */
+extern const struct dma_fence_ops mock_fence_ops;
+struct dma_fence *alloc_dma_fence(u64 context, u64 seqno);
+
+#endif /* __SELFTEST_H__ */
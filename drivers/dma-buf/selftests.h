@@ -0,0 +1,14 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * List each unit test as selftest(name, function)
+ *
+ * The name is used for the log messages, and the function is called with
+ * no arguments and returns 0 on success or a negative errno.
+ *
+ * Tests are executed in the order listed here.
+ */
+selftest(dma_fence_array, dma_fence_array)
+selftest(dma_fence_chain, dma_fence_chain)
+selftest(dma_resv, dma_resv)
+selftest(fence_bench, dma_fence_bench)
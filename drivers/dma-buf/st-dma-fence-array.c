@@ -0,0 +1,114 @@
+// SPDX-License-Identifier: MIT
+
+#include <linux/dma-fence.h>
+#include <linux/dma-fence-array.h>
+#include <linux/slab.h>
+
+#include "selftest.h"
+
+static int test_builder(void *arg)
+{
+	static const unsigned int ctx[] = { 0, 0, 1, 2 };
+	static const unsigned int seqno[] = { 1, 2, 1, 1 };
+	struct dma_fence_array_builder b;
+	struct dma_fence *fences[4] = {};
+	struct dma_fence_array *array;
+	struct dma_fence **inner;
+	struct dma_fence *outer = NULL, *result;
+	unsigned int n;
+	u64 context;
+	int err = 0;
+
+	/*
+	 * fences[0] and fences[1] share a context, fences[3] is signaled.
+	 * Merging fences[0], an array of fences[1] and fences[2], and
+	 * fences[3] must leave just fences[1] and fences[2].
+	 */
+
+	context = dma_fence_context_alloc(3);
+	for (n = 0; n < ARRAY_SIZE(fences); n++) {
+		fences[n] = alloc_dma_fence(context + ctx[n], seqno[n]);
+		if (!fences[n]) {
+			err = -ENOMEM;
+			goto out;
+		}
+	}
+	dma_fence_signal(fences[3]);
+
+	inner = kmalloc_array(2, sizeof(*inner), GFP_KERNEL);
+	if (!inner) {
+		err = -ENOMEM;
+		goto out;
+	}
+	inner[0] = dma_fence_get(fences[1]);
+	inner[1] = dma_fence_get(fences[2]);
+	array = dma_fence_array_create(2, inner, dma_fence_context_alloc(1),
+				       1, false);
+	if (!array) {
+		dma_fence_put(inner[0]);
+		dma_fence_put(inner[1]);
+		kfree(inner);
+		err = -ENOMEM;
+		goto out;
+	}
+	outer = &array->base;
+
+	dma_fence_array_builder_init(&b);
+	dma_fence_array_builder_add(&b, fences[0]);
+	dma_fence_array_builder_add(&b, outer);
+	dma_fence_array_builder_add(&b, fences[3]);
+	result = dma_fence_array_builder_finish(&b, dma_fence_context_alloc(1),
+						1);
+	array = to_dma_fence_array(result);
+	if (!array || array->num_fences != 2 ||
+	    array->fences[0] != fences[1] || array->fences[1] != fences[2]) {
+		pr_err("fence array builder did not flatten and dedup\n");
+		err = -EINVAL;
+	}
+	dma_fence_put(result);
+	if (err)
+		goto out;
+
+	dma_fence_array_builder_init(&b);
+	dma_fence_array_builder_add(&b, fences[1]);
+	dma_fence_array_builder_add(&b, fences[0]);
+	result = dma_fence_array_builder_finish(&b, dma_fence_context_alloc(1),
+						1);
+	if (result != fences[1]) {
+		pr_err("fence array builder did not return the single fence\n");
+		err = -EINVAL;
+	}
+	dma_fence_put(result);
+	if (err)
+		goto out;
+
+	for (n = 0; n < ARRAY_SIZE(fences); n++)
+		dma_fence_signal(fences[n]);
+
+	dma_fence_array_builder_init(&b);
+	dma_fence_array_builder_add(&b, outer);
+	result = dma_fence_array_builder_finish(&b, dma_fence_context_alloc(1),
+						1);
+	if (result) {
+		pr_err("fence array builder kept signaled fences\n");
+		dma_fence_put(result);
+		err = -EINVAL;
+	}
+
+out:
+	dma_fence_put(outer);
+	for (n = 0; n < ARRAY_SIZE(fences) && fences[n]; n++) {
+		dma_fence_signal(fences[n]);
+		dma_fence_put(fences[n]);
+	}
+	return err;
+}
+
+int dma_fence_array(void)
+{
+	static const struct subtest tests[] = {
+		SUBTEST(test_builder),
+	};
+
+	return subtests(tests, NULL);
+}
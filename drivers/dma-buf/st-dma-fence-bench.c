@@ -0,0 +1,295 @@
+// SPDX-License-Identifier: MIT
+
+#include <linux/delay.h>
+#include <linux/dma-fence.h>
+#include <linux/dma-fence-array.h>
+#include <linux/dma-fence-chain.h>
+#include <linux/dma-resv.h>
+#include <linux/kthread.h>
+#include <linux/random.h>
+#include <linux/sched.h>
+#include <linux/slab.h>
+
+#include "selftest.h"
+
+#define FENCE_BENCH_CHAIN	1024
+#define FENCE_BENCH_ARRAY	8
+
+struct fence_bench_thread;
+
+struct fence_bench {
+	const char *name;
+	int (*op)(struct fence_bench *b, struct fence_bench_thread *t);
+	struct dma_resv resv;
+	struct dma_fence *chain;
+	atomic_long_t ops;
+};
+
+struct fence_bench_thread {
+	struct fence_bench *bench;
+	struct task_struct *tsk;
+	spinlock_t lock;
+	u64 context;
+	u64 seqno;
+};
+
+static struct dma_fence *fence_bench_alloc(struct fence_bench_thread *t)
+{
+	struct dma_fence *f;
+
+	f = kmalloc(sizeof(*f), GFP_KERNEL);
+	if (f)
+		dma_fence_init(f, &mock_fence_ops, &t->lock,
+			       t->context, ++t->seqno);
+
+	return f;
+}
+
+static void fence_bench_cb(struct dma_fence *f, struct dma_fence_cb *cb)
+{
+}
+
+static int fence_bench_signal(struct fence_bench *b,
+			      struct fence_bench_thread *t)
+{
+	struct dma_fence_cb cb;
+	struct dma_fence *f;
+
+	f = fence_bench_alloc(t);
+	if (!f)
+		return -ENOMEM;
+
+	dma_fence_add_callback(f, &cb, fence_bench_cb);
+	dma_fence_signal(f);
+	dma_fence_put(f);
+	return 0;
+}
+
+static int fence_bench_resv(struct fence_bench *b,
+			    struct fence_bench_thread *t)
+{
+	struct dma_resv_iter cursor;
+	struct dma_fence *f, *iter;
+	unsigned int count = 0;
+	int err;
+
+	f = fence_bench_alloc(t);
+	if (!f)
+		return -ENOMEM;
+
+	dma_resv_lock(&b->resv, NULL);
+	err = dma_resv_reserve_fences(&b->resv, 1);
+	if (!err)
+		dma_resv_add_fence(&b->resv, f, DMA_RESV_USAGE_READ);
+	dma_resv_unlock(&b->resv);
+
+	/* Our own fence is still busy, so the walk must find it */
+	if (!err) {
+		dma_resv_iter_begin(&cursor, &b->resv, DMA_RESV_USAGE_READ);
+		dma_resv_for_each_fence_unlocked(&cursor, iter)
+			count++;
+		dma_resv_iter_end(&cursor);
+		if (!count)
+			err = -EINVAL;
+	}
+
+	dma_fence_signal(f);
+	dma_fence_put(f);
+	return err;
+}
+
+static int fence_bench_chain(struct fence_bench *b,
+			     struct fence_bench_thread *t)
+{
+	struct dma_fence *f;
+	u64 seqno;
+	int err;
+
+	seqno = 1 + get_random_u32() % FENCE_BENCH_CHAIN;
+	f = dma_fence_get(b->chain);
+	err = dma_fence_chain_find_seqno(&f, seqno);
+	if (!err && (!f || f->seqno != seqno))
+		err = -EINVAL;
+	dma_fence_put(f);
+
+	return err;
+}
+
+static int fence_bench_array(struct fence_bench *b,
+			     struct fence_bench_thread *t)
+{
+	struct dma_fence_array *array;
+	struct dma_fence **fences;
+	unsigned int n;
+
+	fences = kmalloc_array(FENCE_BENCH_ARRAY, sizeof(*fences), GFP_KERNEL);
+	if (!fences)
+		return -ENOMEM;
+
+	for (n = 0; n < FENCE_BENCH_ARRAY; n++) {
+		fences[n] = fence_bench_alloc(t);
+		if (!fences[n])
+			goto err;
+	}
+
+	array = dma_fence_array_create(FENCE_BENCH_ARRAY, fences, t->context,
+				       t->seqno, false);
+	if (!array)
+		goto err;
+
+	dma_fence_enable_sw_signaling(&array->base);
+	for (n = 0; n < FENCE_BENCH_ARRAY; n++)
+		dma_fence_signal(array->fences[n]);
+	dma_fence_wait(&array->base, false);
+	dma_fence_put(&array->base);
+
+	return 0;
+
+err:
+	while (n--)
+		dma_fence_put(fences[n]);
+	kfree(fences);
+	return -ENOMEM;
+}
+
+static int fence_bench_thread(void *arg)
+{
+	struct fence_bench_thread *t = arg;
+	unsigned long count = 0;
+	int err = 0;
+
+	while (!kthread_should_stop()) {
+		err = t->bench->op(t->bench, t);
+		if (err)
+			break;
+
+		count++;
+		cond_resched();
+	}
+
+	atomic_long_add(count, &t->bench->ops);
+	return err;
+}
+
+static int fence_bench_run(struct fence_bench *b, unsigned int nthreads)
+{
+	struct fence_bench_thread *threads;
+	unsigned int n;
+	ktime_t dt;
+	int err = 0;
+
+	threads = kcalloc(nthreads, sizeof(*threads), GFP_KERNEL);
+	if (!threads)
+		return -ENOMEM;
+
+	atomic_long_set(&b->ops, 0);
+	dt = ktime_get();
+	for (n = 0; n < nthreads; n++) {
+		struct fence_bench_thread *t = &threads[n];
+
+		t->bench = b;
+		spin_lock_init(&t->lock);
+		t->context = dma_fence_context_alloc(1);
+
+		t->tsk = kthread_run(fence_bench_thread, t, "st/fence/%d", n);
+		if (IS_ERR(t->tsk)) {
+			err = PTR_ERR(t->tsk);
+			nthreads = n;
+			break;
+		}
+
+		get_task_struct(t->tsk);
+	}
+
+	yield(); /* start all threads before we begin */
+	msleep(20);
+
+	for (n = 0; n < nthreads; n++) {
+		int status;
+
+		status = kthread_stop(threads[n].tsk);
+		if (status && !err)
+			err = status;
+
+		put_task_struct(threads[n].tsk);
+	}
+	dt = ktime_sub(ktime_get(), dt);
+
+	if (!err)
+		pr_info("%s: %u threads, %llu ops/s\n", b->name, nthreads,
+			div64_u64((u64)atomic_long_read(&b->ops) * NSEC_PER_SEC,
+				  ktime_to_ns(dt) ?: 1));
+
+	kfree(threads);
+	return err;
+}
+
+static int bench_fence_ops(void *arg)
+{
+	static const struct {
+		const char *name;
+		int (*op)(struct fence_bench *b, struct fence_bench_thread *t);
+	} phases[] = {
+		{ "signal", fence_bench_signal },
+		{ "resv add/iterate", fence_bench_resv },
+		{ "chain lookup", fence_bench_chain },
+		{ "array wait", fence_bench_array },
+	};
+	struct fence_bench b = {};
+	struct dma_fence_chain *chain;
+	struct dma_fence *f;
+	unsigned int i, nthreads;
+	u64 context;
+	int err = 0;
+
+	/*
+	 * Throughput of the core fence operations from 1 to 64 threads, to
+	 * catch contention regressions in dma-fence, dma-resv, the chain
+	 * lookup and dma-fence-array without any hardware.
+	 */
+
+	dma_resv_init(&b.resv);
+
+	context = dma_fence_context_alloc(1);
+	for (i = 1; i <= FENCE_BENCH_CHAIN; i++) {
+		f = alloc_dma_fence(context, i);
+		chain = dma_fence_chain_alloc();
+		if (!f || !chain) {
+			kfree(f);
+			dma_fence_chain_free(chain);
+			err = -ENOMEM;
+			goto out;
+		}
+
+		dma_fence_chain_init(chain, b.chain, f, i);
+		b.chain = &chain->base;
+	}
+
+	for (i = 0; i < ARRAY_SIZE(phases); i++) {
+		b.name = phases[i].name;
+		b.op = phases[i].op;
+
+		for (nthreads = 1; nthreads <= 64; nthreads <<= 1) {
+			err = fence_bench_run(&b, nthreads);
+			if (err) {
+				pr_err("%s failed with %u threads: %d\n",
+				       b.name, nthreads, err);
+				goto out;
+			}
+		}
+	}
+
+out:
+	dma_fence_put(b.chain);
+	dma_resv_fini(&b.resv);
+	return err;
+}
+
+int dma_fence_bench(void)
+{
+	static const struct subtest tests[] = {
+		SUBTEST(bench_fence_ops),
+	};
+
+	return subtests(tests, NULL);
+}
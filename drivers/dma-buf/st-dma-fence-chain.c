@@ -0,0 +1,139 @@
+// SPDX-License-Identifier: MIT
+
+#include <linux/dma-fence.h>
+#include <linux/dma-fence-chain.h>
+#include <linux/slab.h>
+
+#include "selftest.h"
+
+#define CHAIN_SZ 4
+
+struct fence_chains {
+	unsigned int count;
+	struct dma_fence *fences[CHAIN_SZ];
+	struct dma_fence *chains[CHAIN_SZ];
+};
+
+static int fence_chains_init(struct fence_chains *fc, const u64 *seqno,
+			     unsigned int count)
+{
+	struct dma_fence_chain *chain;
+	struct dma_fence *prev = NULL;
+	unsigned int i;
+
+	memset(fc, 0, sizeof(*fc));
+	for (i = 0; i < count; i++) {
+		fc->fences[i] = alloc_dma_fence(dma_fence_context_alloc(1), 1);
+		chain = dma_fence_chain_alloc();
+		if (!fc->fences[i] || !chain) {
+			dma_fence_chain_free(chain);
+			return -ENOMEM;
+		}
+
+		dma_fence_chain_init(chain, dma_fence_get(prev),
+				     dma_fence_get(fc->fences[i]), seqno[i]);
+		fc->chains[i] = prev = &chain->base;
+		fc->count++;
+	}
+
+	return 0;
+}
+
+static void fence_chains_fini(struct fence_chains *fc)
+{
+	unsigned int i;
+
+	for (i = 0; i < CHAIN_SZ; i++) {
+		if (fc->fences[i])
+			dma_fence_signal(fc->fences[i]);
+		dma_fence_put(fc->chains[i]);
+		dma_fence_put(fc->fences[i]);
+	}
+}
+
+static int find_seqno_check(struct fence_chains *fc, u64 seqno,
+			    struct dma_fence *expect)
+{
+	struct dma_fence *f;
+	int err;
+
+	f = dma_fence_get(fc->chains[fc->count - 1]);
+	err = dma_fence_chain_find_seqno(&f, seqno);
+	if (err) {
+		pr_err("find_seqno(%llu) failed with %d\n", seqno, err);
+	} else if (f != expect) {
+		pr_err("find_seqno(%llu) returned point %llu, expected %llu\n",
+		       seqno, f ? f->seqno : 0, expect ? expect->seqno : 0);
+		err = -EINVAL;
+	}
+	dma_fence_put(f);
+
+	return err;
+}
+
+static int find_gap(void *arg)
+{
+	static const u64 seqno[] = { 2, 4 };
+	struct fence_chains fc;
+	int err;
+
+	/* Without a point at the seqno the next later point is the answer */
+
+	err = fence_chains_init(&fc, seqno, ARRAY_SIZE(seqno));
+	if (err)
+		goto out;
+
+	err = find_seqno_check(&fc, 1, fc.chains[0]);
+	if (!err)
+		err = find_seqno_check(&fc, 3, fc.chains[1]);
+	if (!err)
+		err = find_seqno_check(&fc, 4, fc.chains[1]);
+
+out:
+	fence_chains_fini(&fc);
+	return err;
+}
+
+static int find_pruned(void *arg)
+{
+	static const u64 seqno[] = { 1, 2, 3, 4 };
+	struct fence_chains fc;
+	struct dma_fence *f;
+	int err;
+
+	err = fence_chains_init(&fc, seqno, ARRAY_SIZE(seqno));
+	if (err)
+		goto out;
+
+	/*
+	 * Signal point 2 and let a walk from the tip prune it, once our own
+	 * reference is gone it has left the index as well. Looking it up must
+	 * still give the same answer as walking the chain, which is the
+	 * unsignaled point 1 and not point 3.
+	 */
+	dma_fence_signal(fc.fences[1]);
+	dma_fence_chain_for_each(f, fc.chains[fc.count - 1])
+		;
+	dma_fence_put(fc.chains[1]);
+	fc.chains[1] = NULL;
+
+	err = find_seqno_check(&fc, 2, fc.chains[0]);
+	if (!err)
+		err = find_seqno_check(&fc, 1, fc.chains[0]);
+	if (!err)
+		err = find_seqno_check(&fc, 3, fc.chains[2]);
+
+out:
+	fence_chains_fini(&fc);
+	return err;
+}
+
+int dma_fence_chain(void)
+{
+	static const struct subtest tests[] = {
+		SUBTEST(find_gap),
+		SUBTEST(find_pruned),
+	};
+
+	return subtests(tests, NULL);
+}
@@ -0,0 +1,176 @@
+// SPDX-License-Identifier: MIT
+
+#include <linux/dma-fence.h>
+#include <linux/dma-resv.h>
+#include <linux/ktime.h>
+#include <linux/slab.h>
+
+#include "selftest.h"
+
+static int test_inline_fences(void *arg)
+{
+	static const unsigned int counts[] = { 1, 2, 4, 8, 16 };
+	const unsigned int passes = 1024;
+	struct dma_fence *fences[16] = {};
+	struct dma_resv resv;
+	unsigned int i, n, pass, count;
+	bool inl;
+	ktime_t t;
+	int err = 0;
+
+	/*
+	 * Time filling a reservation object with a few unsignaled fences and
+	 * asking whether it is idle, which is the common pattern for a buffer
+	 * passing through execbuf. Up to DMA_RESV_INLINE_FENCES fences must
+	 * not need a separate fence list.
+	 */
+
+	for (n = 0; n < ARRAY_SIZE(fences); n++) {
+		fences[n] = alloc_dma_fence(dma_fence_context_alloc(1), 1);
+		if (!fences[n]) {
+			err = -ENOMEM;
+			goto out;
+		}
+	}
+
+	for (i = 0; i < ARRAY_SIZE(counts); i++) {
+		count = counts[i];
+		inl = true;
+
+		t = ktime_get();
+		for (pass = 0; pass < passes; pass++) {
+			dma_resv_init(&resv);
+
+			dma_resv_lock(&resv, NULL);
+			err = dma_resv_reserve_fences(&resv, count);
+			for (n = 0; !err && n < count; n++)
+				dma_resv_add_fence(&resv, fences[n],
+						   DMA_RESV_USAGE_READ);
+			inl &= rcu_access_pointer(resv.fences) ==
+				(void *)&resv.inline_fences;
+			dma_resv_unlock(&resv);
+
+			if (!err && dma_resv_test_signaled(&resv,
+							   DMA_RESV_USAGE_READ)) {
+				pr_err("dma_resv idle with %u busy fences\n",
+				       count);
+				err = -EINVAL;
+			}
+
+			dma_resv_fini(&resv);
+			if (err)
+				goto out;
+		}
+		t = ktime_sub(ktime_get(), t);
+
+		if (inl != (count <= DMA_RESV_INLINE_FENCES)) {
+			pr_err("dma_resv with %u fences %s inline storage\n",
+			       count, inl ? "used" : "did not use");
+			err = -EINVAL;
+			goto out;
+		}
+
+		pr_info("dma_resv with %u fences: %lluns per add and test\n",
+			count, div64_u64(ktime_to_ns(t), passes));
+	}
+
+	for (n = 0; n < ARRAY_SIZE(fences); n++)
+		dma_fence_signal(fences[n]);
+
+	dma_resv_init(&resv);
+	dma_resv_lock(&resv, NULL);
+	err = dma_resv_reserve_fences(&resv, ARRAY_SIZE(fences));
+	for (n = 0; !err && n < ARRAY_SIZE(fences); n++)
+		dma_resv_add_fence(&resv, fences[n], DMA_RESV_USAGE_READ);
+	dma_resv_unlock(&resv);
+	if (!err && !dma_resv_test_signaled(&resv, DMA_RESV_USAGE_READ)) {
+		pr_err("dma_resv busy with only signaled fences\n");
+		err = -EINVAL;
+	}
+	dma_resv_fini(&resv);
+
+out:
+	for (n = 0; n < ARRAY_SIZE(fences) && fences[n]; n++) {
+		dma_fence_signal(fences[n]);
+		dma_fence_put(fences[n]);
+	}
+	return err;
+}
+
+static int test_compact(void *arg)
+{
+	struct dma_fence *fences[8] = {};
+	struct dma_resv_list *list;
+	struct dma_resv resv;
+	unsigned int n;
+	int err;
+
+	/* Signaled fences are dropped in place, but only before the list grows */
+
+	for (n = 0; n < ARRAY_SIZE(fences); n++) {
+		fences[n] = alloc_dma_fence(dma_fence_context_alloc(1), 1);
+		if (!fences[n]) {
+			err = -ENOMEM;
+			goto out;
+		}
+	}
+
+	dma_resv_init(&resv);
+	dma_resv_lock(&resv, NULL);
+
+	err = dma_resv_reserve_fences(&resv, ARRAY_SIZE(fences));
+	for (n = 0; !err && n < ARRAY_SIZE(fences); n++)
+		dma_resv_add_fence(&resv, fences[n], DMA_RESV_USAGE_READ);
+	if (err)
+		goto out_resv;
+
+	for (n = 0; n < ARRAY_SIZE(fences) - 2; n++)
+		dma_fence_signal(fences[n]);
+
+	list = rcu_dereference_protected(resv.fences, true);
+	err = dma_resv_reserve_fences(&resv, list->max_fences - 2);
+	if (err)
+		goto out_resv;
+
+	if (rcu_dereference_protected(resv.fences, true) != list) {
+		pr_err("dma_resv reallocated its fences instead of compacting\n");
+		err = -EINVAL;
+	} else if (list->num_fences != 2) {
+		pr_err("dma_resv kept %u fences, expected 2\n",
+		       list->num_fences);
+		err = -EINVAL;
+	}
+	if (err)
+		goto out_resv;
+
+	/* With room to spare the list is left alone */
+	dma_fence_signal(fences[ARRAY_SIZE(fences) - 2]);
+	err = dma_resv_reserve_fences(&resv, 1);
+	if (err)
+		goto out_resv;
+
+	if (list->num_fences != 2) {
+		pr_err("dma_resv compacted a list with room left\n");
+		err = -EINVAL;
+	}
+
+out_resv:
+	dma_resv_unlock(&resv);
+	dma_resv_fini(&resv);
+out:
+	for (n = 0; n < ARRAY_SIZE(fences) && fences[n]; n++) {
+		dma_fence_signal(fences[n]);
+		dma_fence_put(fences[n]);
+	}
+	return err;
+}
+
+int dma_resv(void)
+{
+	static const struct subtest tests[] = {
+		SUBTEST(test_inline_fences),
+		SUBTEST(test_compact),
+	};
+
+	return subtests(tests, NULL);
+}
@@ -145,33 +145,6 @@ char *sync_file_get_name(struct sync_file *sync_file, char *buf, int len)
 	return buf;
 }
 
-static int sync_file_set_fence(struct sync_file *sync_file,
-			       struct dma_fence **fences, int num_fences)
-{
-	struct dma_fence_array *array;
-
-	/*
-	 * The reference for the fences in the new sync_file and held
-	 * in add_fence() during the merge procedure, so for num_fences == 1
-	 * we already own a new reference to the fence. For num_fence > 1
-	 * we own the reference of the dma_fence_array creation.
-	 */
-	if (num_fences == 1) {
-		sync_file->fence = fences[0];
-		kfree(fences);
-	} else {
-		array = dma_fence_array_create(num_fences, fences,
-					       dma_fence_context_alloc(1),
-					       1, false);
-		if (!array)
-			return -ENOMEM;
-
-		sync_file->fence = &array->base;
-	}
-
-	return 0;
-}
-
 static struct dma_fence **get_fences(struct sync_file *sync_file,
 				     int *num_fences)
 {
@@ -186,15 +159,24 @@ static struct dma_fence **get_fences(struct sync_file *sync_file,
 	return &sync_file->fence;
 }
 
-static void add_fence(struct dma_fence **fences,
-		      int *i, struct dma_fence *fence)
+/*
+ * Collapse the fences gathered in @b into the fence of @sync_file. The
+ * builder keeps the latest unsignaled fence of every context, ordered by
+ * context, which is what sync_file_merge() and sync_file_merge_many() promise
+ * about the result. If every fence already signaled the sync_file gets the
+ * signaled stub fence.
+ */
+static void sync_file_set_fence(struct sync_file *sync_file,
+				struct dma_fence_array_builder *b)
 {
-	fences[*i] = fence;
+	struct dma_fence *fence;
 
-	if (!dma_fence_is_signaled(fence)) {
-		dma_fence_get(fence);
-		(*i)++;
-	}
+	fence = dma_fence_array_builder_finish(b, dma_fence_context_alloc(1),
+					       1);
+	if (!fence)
+		fence = dma_fence_get_stub();
+
+	sync_file->fence = fence;
 }
 
 /**
@@ -210,85 +192,52 @@ static void add_fence(struct dma_fence **fences,
 static struct sync_file *sync_file_merge(const char *name, struct sync_file *a,
 					 struct sync_file *b)
 {
+	struct dma_fence_array_builder builder;
 	struct sync_file *sync_file;
-	struct dma_fence **fences, **nfences, **a_fences, **b_fences;
-	int i, i_a, i_b, num_fences, a_num_fences, b_num_fences;
 
 	sync_file = sync_file_alloc();
 	if (!sync_file)
 		return NULL;
 
-	a_fences = get_fences(a, &a_num_fences);
-	b_fences = get_fences(b, &b_num_fences);
-	if (a_num_fences > INT_MAX - b_num_fences)
-		goto err;
-
-	num_fences = a_num_fences + b_num_fences;
+	dma_fence_array_builder_init(&builder);
+	dma_fence_array_builder_add(&builder, a->fence);
+	dma_fence_array_builder_add(&builder, b->fence);
+	sync_file_set_fence(sync_file, &builder);
 
-	fences = kcalloc(num_fences, sizeof(*fences), GFP_KERNEL);
-	if (!fences)
-		goto err;
-
-	/*
-	 * Assume sync_file a and b are both ordered and have no
-	 * duplicates with the same context.
-	 *
-	 * If a sync_file can only be created with sync_file_merge
-	 * and sync_file_create, this is a reasonable assumption.
-	 */
-	for (i = i_a = i_b = 0; i_a < a_num_fences && i_b < b_num_fences; ) {
-		struct dma_fence *pt_a = a_fences[i_a];
-		struct dma_fence *pt_b = b_fences[i_b];
-
-		if (pt_a->context < pt_b->context) {
-			add_fence(fences, &i, pt_a);
-
-			i_a++;
-		} else if (pt_a->context > pt_b->context) {
-			add_fence(fences, &i, pt_b);
-
-			i_b++;
-		} else {
-			if (__dma_fence_is_later(pt_a->seqno, pt_b->seqno,
-						 pt_a->ops))
-				add_fence(fences, &i, pt_a);
-			else
-				add_fence(fences, &i, pt_b);
-
-			i_a++;
-			i_b++;
-		}
-	}
-
-	for (; i_a < a_num_fences; i_a++)
-		add_fence(fences, &i, a_fences[i_a]);
-
-	for (; i_b < b_num_fences; i_b++)
-		add_fence(fences, &i, b_fences[i_b]);
-
-	if (i == 0)
-		fences[i++] = dma_fence_get(a_fences[0]);
+	strlcpy(sync_file->user_name, name, sizeof(sync_file->user_name));
+	return sync_file;
+}
 
-	if (num_fences > i) {
-		nfences = krealloc_array(fences, i, sizeof(*fences), GFP_KERNEL);
-		if (!nfences)
-			goto err;
+/**
+ * sync_file_merge_many() - merge any number of sync_files
+ * @name:	name of new fence
+ * @files:	sync_files to merge
+ * @num_files:	number of entries in @files, at least one
+ *
+ * Creates a new sync_file which contains the latest unsignaled fence of
+ * every context found in @files. Unlike chaining sync_file_merge() this
+ * builds a single fence array whatever the number of inputs. Returns the
+ * new merged sync_file or NULL in case of error.
+ */
+static struct sync_file *sync_file_merge_many(const char *name,
+					      struct sync_file **files,
+					      int num_files)
+{
+	struct dma_fence_array_builder builder;
+	struct sync_file *sync_file;
+	int i;
 
-		fences = nfences;
-	}
+	sync_file = sync_file_alloc();
+	if (!sync_file)
+		return NULL;
 
-	if (sync_file_set_fence(sync_file, fences, i) < 0) {
-		kfree(fences);
-		goto err;
-	}
+	dma_fence_array_builder_init(&builder);
+	for (i = 0; i < num_files; i++)
+		dma_fence_array_builder_add(&builder, files[i]->fence);
+	sync_file_set_fence(sync_file, &builder);
 
 	strlcpy(sync_file->user_name, name, sizeof(sync_file->user_name));
 	return sync_file;
-
-err:
-	fput(sync_file->file);
-	return NULL;
-
 }
 
 static int sync_file_release(struct inode *inode, struct file *file)
@@ -378,6 +327,80 @@ err_put_fd:
 	return err;
 }
 
+/* Upper bound on the number of fds taken by SYNC_IOC_MERGE_MANY */
+#define SYNC_MERGE_MANY_MAX_FDS	1024
+
+static long sync_file_ioctl_merge_many(struct sync_file *sync_file,
+				       unsigned long arg)
+{
+	struct sync_merge_many_data data;
+	struct sync_file **files, *merged;
+	s32 __user *fds;
+	int fd, err, i, num_files;
+	s32 fd2;
+
+	if (copy_from_user(&data, (void __user *)arg, sizeof(data)))
+		return -EFAULT;
+
+	if (data.flags || data.pad)
+		return -EINVAL;
+
+	if (data.num_fds == 0 || data.num_fds > SYNC_MERGE_MANY_MAX_FDS)
+		return -EINVAL;
+
+	files = kcalloc(data.num_fds + 1, sizeof(*files), GFP_KERNEL);
+	if (!files)
+		return -ENOMEM;
+
+	files[0] = sync_file;
+	num_files = 1;
+	fds = u64_to_user_ptr(data.fds);
+	for (i = 0; i < data.num_fds; i++) {
+		if (get_user(fd2, &fds[i])) {
+			err = -EFAULT;
+			goto out_put_files;
+		}
+		files[num_files] = sync_file_fdget(fd2);
+		if (!files[num_files]) {
+			err = -ENOENT;
+			goto out_put_files;
+		}
+		num_files++;
+	}
+
+	fd = get_unused_fd_flags(O_CLOEXEC);
+	if (fd < 0) {
+		err = fd;
+		goto out_put_files;
+	}
+
+	data.name[sizeof(data.name) - 1] = '\0';
+	merged = sync_file_merge_many(data.name, files, num_files);
+	if (!merged) {
+		err = -ENOMEM;
+		goto err_put_fd;
+	}
+
+	data.fence = fd;
+	if (copy_to_user((void __user *)arg, &data, sizeof(data))) {
+		err = -EFAULT;
+		fput(merged->file);
+		goto err_put_fd;
+	}
+
+	fd_install(fd, merged->file);
+	err = 0;
+	goto out_put_files;
+
+err_put_fd:
+	put_unused_fd(fd);
+out_put_files:
+	while (num_files-- > 1)
+		fput(files[num_files]->file);
+	kfree(files);
+	return err;
+}
+
 static int sync_fill_fence_info(struct dma_fence *fence,
 				 struct sync_fence_info *info)
 {
@@ -462,6 +485,21 @@ out:
 	return ret;
 }
 
+static long sync_file_ioctl_set_deadline(struct sync_file *sync_file,
+					 unsigned long arg)
+{
+	struct sync_set_deadline ts;
+
+	if (copy_from_user(&ts, (void __user *)arg, sizeof(ts)))
+		return -EFAULT;
+
+	if (ts.pad)
+		return -EINVAL;
+
+	dma_fence_set_deadline(sync_file->fence, ns_to_ktime(ts.deadline_ns));
+	return 0;
+}
+
 static long sync_file_ioctl(struct file *file, unsigned int cmd,
 			    unsigned long arg)
 {
@@ -474,6 +512,12 @@ static long sync_file_ioctl(struct file *file, unsigned int cmd,
 	case SYNC_IOC_FILE_INFO:
 		return sync_file_ioctl_fence_info(sync_file, arg);
 
+	case SYNC_IOC_SET_DEADLINE:
+		return sync_file_ioctl_set_deadline(sync_file, arg);
+
+	case SYNC_IOC_MERGE_MANY:
+		return sync_file_ioctl_merge_many(sync_file, arg);
+
 	default:
 		return -ENOTTY;
 	}
@@ -3,6 +3,7 @@
  * Copyright © 2021 Intel Corporation
  */
 
+#include <linux/bitmap.h>
 #include <linux/kmemleak.h>
 #include <linux/module.h>
 #include <linux/sizes.h>
@@ -38,12 +39,70 @@ static void drm_block_free(struct drm_buddy *mm,
 	kmem_cache_free(slab_blocks, block);
 }
 
-static void mark_allocated(struct drm_buddy_block *block)
+static inline struct drm_buddy_block *rb_to_block(struct rb_node *rb)
+{
+	return rb_entry_safe(rb, struct drm_buddy_block, rb);
+}
+
+static void free_tree_insert(struct drm_buddy *mm,
+			     struct drm_buddy_block *block)
+{
+	unsigned int order = drm_buddy_block_order(block);
+	struct rb_node **link = &mm->free_tree[order].rb_node;
+	u64 offset = drm_buddy_block_offset(block);
+	struct rb_node *parent = NULL;
+
+	while (*link) {
+		parent = *link;
+		if (offset < drm_buddy_block_offset(rb_to_block(parent)))
+			link = &parent->rb_left;
+		else
+			link = &parent->rb_right;
+	}
+
+	rb_link_node(&block->rb, parent, link);
+	rb_insert_color(&block->rb, &mm->free_tree[order]);
+	__set_bit(order, mm->free_orders);
+}
+
+static void free_tree_remove(struct drm_buddy *mm,
+			     struct drm_buddy_block *block)
+{
+	unsigned int order = drm_buddy_block_order(block);
+
+	rb_erase(&block->rb, &mm->free_tree[order]);
+	if (RB_EMPTY_ROOT(&mm->free_tree[order]))
+		__clear_bit(order, mm->free_orders);
+}
+
+/* Return the first free block of @order which ends at or after @offset */
+static struct drm_buddy_block *
+free_tree_find(struct drm_buddy *mm, unsigned int order, u64 offset)
+{
+	struct rb_node *rb = mm->free_tree[order].rb_node;
+	struct drm_buddy_block *block, *found = NULL;
+	u64 size = mm->chunk_size << order;
+
+	while (rb) {
+		block = rb_to_block(rb);
+		if (drm_buddy_block_offset(block) + size - 1 >= offset) {
+			found = block;
+			rb = rb->rb_left;
+		} else {
+			rb = rb->rb_right;
+		}
+	}
+
+	return found;
+}
+
+static void mark_allocated(struct drm_buddy *mm,
+			   struct drm_buddy_block *block)
 {
 	block->header &= ~DRM_BUDDY_HEADER_STATE;
 	block->header |= DRM_BUDDY_ALLOCATED;
 
-	list_del(&block->link);
+	free_tree_remove(mm, block);
 }
 
 static void mark_free(struct drm_buddy *mm,
@@ -52,16 +111,16 @@ static void mark_free(struct drm_buddy *mm,
 	block->header &= ~DRM_BUDDY_HEADER_STATE;
 	block->header |= DRM_BUDDY_FREE;
 
-	list_add(&block->link,
-		 &mm->free_list[drm_buddy_block_order(block)]);
+	free_tree_insert(mm, block);
 }
 
-static void mark_split(struct drm_buddy_block *block)
+static void mark_split(struct drm_buddy *mm,
+		       struct drm_buddy_block *block)
 {
 	block->header &= ~DRM_BUDDY_HEADER_STATE;
 	block->header |= DRM_BUDDY_SPLIT;
 
-	list_del(&block->link);
+	free_tree_remove(mm, block);
 }
 
 /**
@@ -95,18 +154,28 @@ int drm_buddy_init(struct drm_buddy *mm, u64 size, u64 chunk_size)
 	mm->size = size;
 	mm->avail = size;
 	mm->chunk_size = chunk_size;
+
+	INIT_LIST_HEAD(&mm->cache);
+	mm->cache_count = 0;
+	mm->cache_max = 0;
+	mm->cache_hits = 0;
+	mm->cache_misses = 0;
 	mm->max_order = ilog2(size) - ilog2(chunk_size);
 
 	BUG_ON(mm->max_order > DRM_BUDDY_MAX_ORDER);
 
-	mm->free_list = kmalloc_array(mm->max_order + 1,
-				      sizeof(struct list_head),
+	mm->free_tree = kmalloc_array(mm->max_order + 1,
+				      sizeof(struct rb_root),
 				      GFP_KERNEL);
-	if (!mm->free_list)
+	if (!mm->free_tree)
 		return -ENOMEM;
 
 	for (i = 0; i <= mm->max_order; ++i)
-		INIT_LIST_HEAD(&mm->free_list[i]);
+		mm->free_tree[i] = RB_ROOT;
+
+	mm->free_orders = bitmap_zalloc(mm->max_order + 1, GFP_KERNEL);
+	if (!mm->free_orders)
+		goto out_free_tree;
 
 	mm->n_roots = hweight64(size);
 
@@ -114,7 +183,7 @@ int drm_buddy_init(struct drm_buddy *mm, u64 size, u64 chunk_size)
 				  sizeof(struct drm_buddy_block *),
 				  GFP_KERNEL);
 	if (!mm->roots)
-		goto out_free_list;
+		goto out_free_orders;
 
 	offset = 0;
 	i = 0;
@@ -153,8 +222,10 @@ out_free_roots:
 	while (i--)
 		drm_block_free(mm, mm->roots[i]);
 	kfree(mm->roots);
-out_free_list:
-	kfree(mm->free_list);
+out_free_orders:
+	bitmap_free(mm->free_orders);
+out_free_tree:
+	kfree(mm->free_tree);
 	return -ENOMEM;
 }
 EXPORT_SYMBOL(drm_buddy_init);
@@ -170,6 +241,8 @@ void drm_buddy_fini(struct drm_buddy *mm)
 {
 	int i;
 
+	drm_buddy_cache_drain(mm);
+
 	for (i = 0; i < mm->n_roots; ++i) {
 		WARN_ON(!drm_buddy_block_is_free(mm->roots[i]));
 		drm_block_free(mm, mm->roots[i]);
@@ -178,10 +251,82 @@ void drm_buddy_fini(struct drm_buddy *mm)
 	WARN_ON(mm->avail != mm->size);
 
 	kfree(mm->roots);
-	kfree(mm->free_list);
+	bitmap_free(mm->free_orders);
+	kfree(mm->free_tree);
 }
 EXPORT_SYMBOL(drm_buddy_fini);
 
+static void __drm_buddy_free(struct drm_buddy *mm,
+			     struct drm_buddy_block *block);
+
+/**
+ * drm_buddy_cache_enable - cache freed minimum order blocks
+ *
+ * @mm: DRM buddy manager
+ * @max_blocks: maximum number of blocks to keep, 0 disables the cache
+ *
+ * Freed blocks of the minimum order are kept on a cache instead of being
+ * merged back with their buddies right away, so that the next minimum order
+ * allocation doesn't have to split them off a bigger block again. The cache
+ * is merged back lazily, once an allocation can't be satisfied at the order
+ * it asked for, or by an explicit drm_buddy_cache_drain().
+ *
+ * Cached blocks are still accounted as available.
+ */
+void drm_buddy_cache_enable(struct drm_buddy *mm, unsigned int max_blocks)
+{
+	mm->cache_max = max_blocks;
+	if (mm->cache_count > max_blocks)
+		drm_buddy_cache_drain(mm);
+}
+EXPORT_SYMBOL(drm_buddy_cache_enable);
+
+/**
+ * drm_buddy_cache_drain - merge cached blocks back
+ *
+ * @mm: DRM buddy manager
+ *
+ * Give all blocks on the minimum order cache back to the allocator, merging
+ * them with their buddies where possible.
+ *
+ * Returns:
+ * true if there was anything to drain, false otherwise.
+ */
+bool drm_buddy_cache_drain(struct drm_buddy *mm)
+{
+	struct drm_buddy_block *block, *on;
+
+	if (list_empty(&mm->cache))
+		return false;
+
+	list_for_each_entry_safe(block, on, &mm->cache, link)
+		__drm_buddy_free(mm, block);
+	INIT_LIST_HEAD(&mm->cache);
+	mm->cache_count = 0;
+
+	return true;
+}
+EXPORT_SYMBOL(drm_buddy_cache_drain);
+
+static struct drm_buddy_block *cache_get(struct drm_buddy *mm)
+{
+	struct drm_buddy_block *block;
+
+	block = list_first_entry_or_null(&mm->cache,
+					 struct drm_buddy_block,
+					 link);
+	if (!block) {
+		mm->cache_misses++;
+		return NULL;
+	}
+
+	list_del(&block->link);
+	mm->cache_count--;
+	mm->cache_hits++;
+
+	return block;
+}
+
 static int split_block(struct drm_buddy *mm,
 		       struct drm_buddy_block *block)
 {
@@ -205,7 +350,7 @@ static int split_block(struct drm_buddy *mm,
 	mark_free(mm, block->left);
 	mark_free(mm, block->right);
 
-	mark_split(block);
+	mark_split(mm, block);
 
 	return 0;
 }
@@ -255,7 +400,7 @@ static void __drm_buddy_free(struct drm_buddy *mm,
 		if (!drm_buddy_block_is_free(buddy))
 			break;
 
-		list_del(&buddy->link);
+		free_tree_remove(mm, buddy);
 
 		drm_block_free(mm, block);
 		drm_block_free(mm, buddy);
@@ -277,6 +422,13 @@ void drm_buddy_free_block(struct drm_buddy *mm,
 {
 	BUG_ON(!drm_buddy_block_is_allocated(block));
 	mm->avail += drm_buddy_block_size(mm, block);
+
+	if (!drm_buddy_block_order(block) && mm->cache_count < mm->cache_max) {
+		list_add(&block->link, &mm->cache);
+		mm->cache_count++;
+		return;
+	}
+
 	__drm_buddy_free(mm, block);
 }
 EXPORT_SYMBOL(drm_buddy_free_block);
@@ -309,101 +461,78 @@ static inline bool contains(u64 s1, u64 e1, u64 s2, u64 e2)
 	return s1 <= s2 && e1 >= e2;
 }
 
+/*
+ * Split @block down to @order, following the children which contain @offset.
+ * On failure everything split so far is merged back again.
+ */
 static struct drm_buddy_block *
-alloc_range_bias(struct drm_buddy *mm,
-		 u64 start, u64 end,
-		 unsigned int order)
+split_to_order(struct drm_buddy *mm,
+	       struct drm_buddy_block *block,
+	       unsigned int order, u64 offset)
 {
-	struct drm_buddy_block *block;
-	struct drm_buddy_block *buddy;
-	LIST_HEAD(dfs);
+	struct drm_buddy_block *top = block;
 	int err;
-	int i;
-
-	end = end - 1;
-
-	for (i = 0; i < mm->n_roots; ++i)
-		list_add_tail(&mm->roots[i]->tmp_link, &dfs);
-
-	do {
-		u64 block_start;
-		u64 block_end;
-
-		block = list_first_entry_or_null(&dfs,
-						 struct drm_buddy_block,
-						 tmp_link);
-		if (!block)
-			break;
-
-		list_del(&block->tmp_link);
-
-		if (drm_buddy_block_order(block) < order)
-			continue;
-
-		block_start = drm_buddy_block_offset(block);
-		block_end = block_start + drm_buddy_block_size(mm, block) - 1;
-
-		if (!overlaps(start, end, block_start, block_end))
-			continue;
-
-		if (drm_buddy_block_is_allocated(block))
-			continue;
-
-		if (contains(start, end, block_start, block_end) &&
-		    order == drm_buddy_block_order(block)) {
-			/*
-			 * Find the free block within the range.
-			 */
-			if (drm_buddy_block_is_free(block))
-				return block;
-
-			continue;
-		}
 
-		if (!drm_buddy_block_is_split(block)) {
-			err = split_block(mm, block);
-			if (unlikely(err))
-				goto err_undo;
-		}
+	while (drm_buddy_block_order(block) > order) {
+		err = split_block(mm, block);
+		if (unlikely(err))
+			goto err_undo;
 
-		list_add(&block->right->tmp_link, &dfs);
-		list_add(&block->left->tmp_link, &dfs);
-	} while (1);
+		if (offset < drm_buddy_block_offset(block->right))
+			block = block->left;
+		else
+			block = block->right;
+	}
 
-	return ERR_PTR(-ENOSPC);
+	return block;
 
 err_undo:
 	/*
 	 * We really don't want to leave around a bunch of split blocks, since
-	 * bigger is better, so make sure we merge everything back before we
-	 * free the allocated blocks.
+	 * bigger is better, so make sure we merge everything back.
 	 */
-	buddy = __get_buddy(block);
-	if (buddy &&
-	    (drm_buddy_block_is_free(block) &&
-	     drm_buddy_block_is_free(buddy)))
+	if (block != top) {
+		free_tree_remove(mm, block);
 		__drm_buddy_free(mm, block);
+	}
 	return ERR_PTR(err);
 }
 
+/*
+ * Find the smallest free block from which a block of @order lying within
+ * [@start, @end) can be carved. All blocks are naturally aligned, so for each
+ * order only the first free block reaching past the lowest aligned candidate
+ * needs to be looked at.
+ */
 static struct drm_buddy_block *
-get_maxblock(struct list_head *head)
+alloc_range_bias(struct drm_buddy *mm,
+		 u64 start, u64 end,
+		 unsigned int order)
 {
-	struct drm_buddy_block *max_block = NULL, *node;
+	u64 size = mm->chunk_size << order;
+	struct drm_buddy_block *block;
+	u64 first, offset;
+	unsigned int i;
 
-	max_block = list_first_entry_or_null(head,
-					     struct drm_buddy_block,
-					     link);
-	if (!max_block)
-		return NULL;
+	first = round_up(start, size);
+	if (first < start || first > end || end - first < size)
+		return ERR_PTR(-ENOSPC);
+
+	for (i = find_next_bit(mm->free_orders, mm->max_order + 1, order);
+	     i <= mm->max_order;
+	     i = find_next_bit(mm->free_orders, mm->max_order + 1, i + 1)) {
+		block = free_tree_find(mm, i, first);
+		if (!block)
+			continue;
+
+		offset = max(first, drm_buddy_block_offset(block));
+		if (offset > end || end - offset < size)
+			continue;
 
-	list_for_each_entry(node, head, link) {
-		if (drm_buddy_block_offset(node) >
-		    drm_buddy_block_offset(max_block))
-			max_block = node;
+		return split_to_order(mm, block, order, offset);
 	}
 
-	return max_block;
+	return ERR_PTR(-ENOSPC);
 }
 
 static struct drm_buddy_block *
@@ -411,43 +540,23 @@ alloc_from_freelist(struct drm_buddy *mm,
 		    unsigned int order,
 		    unsigned long flags)
 {
-	struct drm_buddy_block *block = NULL;
+	struct drm_buddy_block *block;
 	unsigned int i;
-	int err;
-
-	for (i = order; i <= mm->max_order; ++i) {
-		if (flags & DRM_BUDDY_TOPDOWN_ALLOCATION) {
-			block = get_maxblock(&mm->free_list[i]);
-			if (block)
-				break;
-		} else {
-			block = list_first_entry_or_null(&mm->free_list[i],
-							 struct drm_buddy_block,
-							 link);
-			if (block)
-				break;
-		}
-	}
 
-	if (!block)
+	i = find_next_bit(mm->free_orders, mm->max_order + 1, order);
+	if (i > mm->max_order)
 		return ERR_PTR(-ENOSPC);
 
-	BUG_ON(!drm_buddy_block_is_free(block));
-
-	while (i != order) {
-		err = split_block(mm, block);
-		if (unlikely(err))
-			goto err_undo;
+	if (flags & DRM_BUDDY_TOPDOWN_ALLOCATION)
+		block = rb_to_block(rb_last(&mm->free_tree[i]));
+	else
+		block = rb_to_block(rb_first(&mm->free_tree[i]));
 
-		block = block->right;
-		i--;
-	}
-	return block;
+	BUG_ON(!drm_buddy_block_is_free(block));
 
-err_undo:
-	if (i != order)
-		__drm_buddy_free(mm, block);
-	return ERR_PTR(err);
+	return split_to_order(mm, block, order,
+			      drm_buddy_block_offset(block) +
+			      drm_buddy_block_size(mm, block) - 1);
 }
 
 static int __alloc_range(struct drm_buddy *mm,
@@ -492,7 +601,7 @@ static int __alloc_range(struct drm_buddy *mm,
 				goto err_free;
 			}
 
-			mark_allocated(block);
+			mark_allocated(mm, block);
 			mm->avail -= drm_buddy_block_size(mm, block);
 			list_add_tail(&block->link, &allocated);
 			continue;
@@ -533,13 +642,25 @@ static int __drm_buddy_alloc_range(struct drm_buddy *mm,
 				   u64 size,
 				   struct list_head *blocks)
 {
+	bool retry = true;
 	LIST_HEAD(dfs);
+	int err;
 	int i;
 
+again:
 	for (i = 0; i < mm->n_roots; ++i)
 		list_add_tail(&mm->roots[i]->tmp_link, &dfs);
 
-	return __alloc_range(mm, &dfs, start, size, blocks);
+	err = __alloc_range(mm, &dfs, start, size, blocks);
+
+	/* Cached blocks look allocated, merge them back and try once more */
+	if (err == -ENOSPC && retry && drm_buddy_cache_drain(mm)) {
+		INIT_LIST_HEAD(&dfs);
+		retry = false;
+		goto again;
+	}
+
+	return err;
 }
 
 /**
@@ -601,7 +722,7 @@ int drm_buddy_block_trim(struct drm_buddy *mm,
 	list_add(&block->tmp_link, &dfs);
 	err =  __alloc_range(mm, &dfs, new_start, new_size, blocks);
 	if (err) {
-		mark_allocated(block);
+		mark_allocated(mm, block);
 		mm->avail -= drm_buddy_block_size(mm, block);
 		list_add(&block->link, blocks);
 	}
@@ -622,11 +743,11 @@ EXPORT_SYMBOL(drm_buddy_block_trim);
  * @blocks: output list head to add allocated blocks
  * @flags: DRM_BUDDY_*_ALLOCATION flags
  *
- * alloc_range_bias() called on range limitations, which traverses
- * the tree and returns the desired block.
+ * alloc_range_bias() called on range limitations, which looks up
+ * the free trees by offset and returns the desired block.
  *
  * alloc_from_freelist() called when *no* range restrictions
- * are enforced, which picks the block from the freelist.
+ * are enforced, which picks the block from the free trees.
  *
  * Returns:
  * 0 on success, error code on failure.
@@ -678,6 +799,15 @@ int drm_buddy_alloc_blocks(struct drm_buddy *mm,
 		BUG_ON(order < min_order);
 
 		do {
+			if (!order && mm->cache_max &&
+			    !(flags & (DRM_BUDDY_RANGE_ALLOCATION |
+				       DRM_BUDDY_TOPDOWN_ALLOCATION))) {
+				/* Cached blocks are still marked allocated */
+				block = cache_get(mm);
+				if (block)
+					break;
+			}
+
 			if (flags & DRM_BUDDY_RANGE_ALLOCATION)
 				/* Allocate traversing within the range */
 				block = alloc_range_bias(mm, start, end, order);
@@ -685,8 +815,14 @@ int drm_buddy_alloc_blocks(struct drm_buddy *mm,
 				/* Allocate from freelist */
 				block = alloc_from_freelist(mm, order, flags);
 
-			if (!IS_ERR(block))
+			if (!IS_ERR(block)) {
+				mark_allocated(mm, block);
 				break;
+			}
+
+			/* Merge the cache back before settling for less */
+			if (drm_buddy_cache_drain(mm))
+				continue;
 
 			if (order-- == min_order) {
 				err = -ENOSPC;
@@ -694,7 +830,6 @@ int drm_buddy_alloc_blocks(struct drm_buddy *mm,
 			}
 		} while (1);
 
-		mark_allocated(block);
 		mm->avail -= drm_buddy_block_size(mm, block);
 		kmemleak_update_trace(block);
 		list_add_tail(&block->link, &allocated);
@@ -745,12 +880,17 @@ void drm_buddy_print(struct drm_buddy *mm, struct drm_printer *p)
 	drm_printf(p, "chunk_size: %lluKiB, total: %lluMiB, free: %lluMiB\n",
 		   mm->chunk_size >> 10, mm->size >> 20, mm->avail >> 20);
 
+	if (mm->cache_max)
+		drm_printf(p, "cache: %u/%u blocks, hits: %llu, misses: %llu\n",
+			   mm->cache_count, mm->cache_max,
+			   mm->cache_hits, mm->cache_misses);
+
 	for (order = mm->max_order; order >= 0; order--) {
-		struct drm_buddy_block *block;
+		struct rb_node *rb;
 		u64 count = 0, free;
 
-		list_for_each_entry(block, &mm->free_list[order], link) {
-			BUG_ON(!drm_buddy_block_is_free(block));
+		for (rb = rb_first(&mm->free_tree[order]); rb; rb = rb_next(rb)) {
+			BUG_ON(!drm_buddy_block_is_free(rb_to_block(rb)));
 			count++;
 		}
 
@@ -58,6 +58,15 @@ void drm_gem_ttm_print_info(struct drm_printer *p, unsigned int indent,
 #else				  
 				  (unsigned long)bo->mem.bus.offset);
 #endif
+
+	drm_printf_indent(p, indent, "faults=%lu prefaulted=%lu prefault_hits=%lu (%lu%%)\n",
+			  bo->vm_stats.faults, bo->vm_stats.prefaulted,
+			  bo->vm_stats.prefault_hits,
+			  bo->vm_stats.prefaulted ?
+			  bo->vm_stats.prefault_hits * 100 /
+			  bo->vm_stats.prefaulted : 0);
+	drm_printf_indent(p, indent, "huge_faults=%lu\n",
+			  bo->vm_stats.huge_faults);
 }
 EXPORT_SYMBOL(drm_gem_ttm_print_info);
 
@@ -249,6 +249,41 @@ static void insert_hole_size(struct rb_root_cached *root,
 RB_DECLARE_CALLBACKS_MAX(static, augment_callbacks,
 			 struct drm_mm_node, rb_hole_addr,
 			 u64, subtree_max_hole, HOLE_SIZE)
+#elif defined(__FreeBSD__)
+static u64 rb_to_subtree_max_hole(struct rb_node *rb)
+{
+	return rb ? rb_entry(rb, struct drm_mm_node,
+			     rb_hole_addr)->subtree_max_hole : 0;
+}
+
+static void augment_compute_max(struct rb_node *rb)
+{
+	struct drm_mm_node *node;
+
+	if (!rb)
+		return;
+
+	node = rb_entry(rb, struct drm_mm_node, rb_hole_addr);
+	node->subtree_max_hole = max3(HOLE_SIZE(node),
+				      rb_to_subtree_max_hole(rb->rb_left),
+				      rb_to_subtree_max_hole(rb->rb_right));
+}
+
+/*
+ * There is no augmented rbtree on FreeBSD, so rebalancing after an insert or
+ * erase leaves subtree_max_hole stale. A rotation only changes the children of
+ * the two nodes it swaps and after the rebalance those are either on the path
+ * from the modified position to the root or direct children of it. Recompute
+ * exactly those, bottom up.
+ */
+static void augment_propagate(struct rb_node *rb)
+{
+	for (; rb; rb = rb_parent(rb)) {
+		augment_compute_max(rb->rb_left);
+		augment_compute_max(rb->rb_right);
+		augment_compute_max(rb);
+	}
+}
 #endif
 
 static void insert_hole_addr(struct rb_root *root, struct drm_mm_node *node)
@@ -273,6 +308,7 @@ static void insert_hole_addr(struct rb_root *root, struct drm_mm_node *node)
 	rb_insert_augmented(&node->rb_hole_addr, root, &augment_callbacks);
 #elif defined(__FreeBSD__)
 	rb_insert_color(&node->rb_hole_addr, root);
+	augment_propagate(&node->rb_hole_addr);
 #endif
 }
 
@@ -293,6 +329,10 @@ static void add_hole(struct drm_mm_node *node)
 
 static void rm_hole(struct drm_mm_node *node)
 {
+#ifdef __FreeBSD__
+	struct rb_node *rb = &node->rb_hole_addr, *bottom;
+#endif
+
 	DRM_MM_BUG_ON(!drm_mm_hole_follows(node));
 
 	list_del(&node->hole_stack);
@@ -301,7 +341,19 @@ static void rm_hole(struct drm_mm_node *node)
 	rb_erase_augmented(&node->rb_hole_addr, &node->mm->holes_addr,
 			   &augment_callbacks);
 #elif defined(__FreeBSD__)
-	rb_erase(&node->rb_hole_addr, &node->mm->holes_addr);
+	/*
+	 * With two children the node is replaced by its successor, so the
+	 * rebalance starts below the successor's old position.
+	 */
+	if (rb->rb_left && rb->rb_right) {
+		bottom = rb_next(rb);
+		if (rb_parent(bottom) != rb)
+			bottom = rb_parent(bottom);
+	} else {
+		bottom = rb_parent(rb);
+	}
+	rb_erase(rb, &node->mm->holes_addr);
+	augment_propagate(bottom);
 #endif
 	node->hole_size = 0;
 	node->subtree_max_hole = 0;
@@ -427,6 +479,51 @@ static struct drm_mm_node *name(struct drm_mm_node *entry, u64 size)	\
 DECLARE_NEXT_HOLE_ADDR(next_hole_high_addr, rb_left, rb_right)
 DECLARE_NEXT_HOLE_ADDR(next_hole_low_addr, rb_right, rb_left)
 
+/*
+ * Best fit restricted to [start, end). The address tree is walked in order
+ * from @start, the augmented subtree_max_hole lets us skip every subtree
+ * without a hole of @size, so only holes which can take the allocation are
+ * visited instead of all holes of the allocator, most of which may be out of
+ * range.
+ */
+static struct drm_mm_node *
+best_hole_in_range(struct drm_mm *mm, u64 start, u64 end, u64 size)
+{
+	struct drm_mm_node *node, *best = NULL;
+	u64 best_size = U64_MAX;
+
+	for (node = find_hole_addr(mm, start, size);
+	     node;
+	     node = next_hole_low_addr(node, size)) {
+		u64 hole_start = __drm_mm_hole_node_start(node);
+		u64 hole_end = hole_start + node->hole_size;
+		u64 avail;
+
+		if (hole_start >= end)
+			break;
+
+		if (hole_end <= start)
+			continue;
+
+		avail = min(hole_end, end) - max(hole_start, start);
+		if (avail < size || avail >= best_size)
+			continue;
+
+		best = node;
+		best_size = avail;
+		if (avail == size)
+			break;
+	}
+
+	return best;
+}
+
+static bool drm_mm_range_is_full(const struct drm_mm *mm, u64 start, u64 end)
+{
+	return start <= mm->head_node.start + mm->head_node.size &&
+	       end >= mm->head_node.start;
+}
+
 static struct drm_mm_node *
 next_hole(struct drm_mm *mm,
 	  struct drm_mm_node *node,
@@ -512,6 +609,75 @@ static u64 rb_to_hole_size_or_zero(struct rb_node *rb)
 	return rb ? rb_to_hole_size(rb) : 0;
 }
 
+static int insert_into_hole(struct drm_mm * const mm,
+			    struct drm_mm_node * const node,
+			    struct drm_mm_node *hole,
+			    u64 size, u64 alignment, u64 remainder_mask,
+			    unsigned long color,
+			    u64 range_start, u64 range_end,
+			    enum drm_mm_insert_mode mode)
+{
+	u64 hole_start = __drm_mm_hole_node_start(hole);
+	u64 hole_end = hole_start + hole->hole_size;
+	u64 adj_start, adj_end;
+	u64 col_start, col_end;
+
+	col_start = hole_start;
+	col_end = hole_end;
+	if (mm->color_adjust)
+		mm->color_adjust(hole, color, &col_start, &col_end);
+
+	adj_start = max(col_start, range_start);
+	adj_end = min(col_end, range_end);
+
+	if (adj_end <= adj_start || adj_end - adj_start < size)
+		return -ENOSPC;
+
+	if (mode == DRM_MM_INSERT_HIGH)
+		adj_start = adj_end - size;
+
+	if (alignment) {
+		u64 rem;
+
+		if (likely(remainder_mask))
+			rem = adj_start & remainder_mask;
+		else
+			div64_u64_rem(adj_start, alignment, &rem);
+		if (rem) {
+			adj_start -= rem;
+			if (mode != DRM_MM_INSERT_HIGH)
+				adj_start += alignment;
+
+			if (adj_start < max(col_start, range_start) ||
+			    min(col_end, range_end) - adj_start < size)
+				return -ENOSPC;
+
+			if (adj_end <= adj_start ||
+			    adj_end - adj_start < size)
+				return -ENOSPC;
+		}
+	}
+
+	node->mm = mm;
+	node->size = size;
+	node->start = adj_start;
+	node->color = color;
+	node->hole_size = 0;
+
+	__set_bit(DRM_MM_NODE_ALLOCATED_BIT, &node->flags);
+	list_add(&node->node_list, &hole->node_list);
+	drm_mm_interval_tree_add_node(hole, node);
+
+	rm_hole(hole);
+	if (adj_start > hole_start)
+		add_hole(hole);
+	if (adj_start + size < hole_end)
+		add_hole(node);
+
+	save_stack(node);
+	return 0;
+}
+
 /**
  * drm_mm_insert_node_in_range - ranged search for space and insert @node
  * @mm: drm_mm to allocate from
@@ -525,6 +691,11 @@ static u64 rb_to_hole_size_or_zero(struct rb_node *rb)
  *
  * The preallocated @node must be cleared to 0.
  *
+ * If the range doesn't cover the whole allocator, DRM_MM_INSERT_BEST picks
+ * the best fitting hole inside the range instead of walking all holes by
+ * size. Should that hole not satisfy the alignment or color constraints, the
+ * remaining holes in the range are tried in DRM_MM_INSERT_LOW order.
+ *
  * Returns:
  * 0 on success, -ENOSPC if there's no suitable hole.
  */
@@ -554,13 +725,29 @@ int drm_mm_insert_node_in_range(struct drm_mm * const mm,
 	mode &= ~DRM_MM_INSERT_ONCE;
 
 	remainder_mask = is_power_of_2(alignment) ? alignment - 1 : 0;
+
+	if (mode == DRM_MM_INSERT_BEST &&
+	    !drm_mm_range_is_full(mm, range_start, range_end)) {
+		hole = best_hole_in_range(mm, range_start, range_end, size);
+		if (!hole)
+			return -ENOSPC;
+
+		if (!insert_into_hole(mm, node, hole, size,
+				      alignment, remainder_mask, color,
+				      range_start, range_end, mode))
+			return 0;
+
+		if (once)
+			return -ENOSPC;
+
+		mode = DRM_MM_INSERT_LOW;
+	}
+
 	for (hole = first_hole(mm, range_start, range_end, size, mode);
 	     hole;
 	     hole = once ? NULL : next_hole(mm, hole, size, mode)) {
 		u64 hole_start = __drm_mm_hole_node_start(hole);
 		u64 hole_end = hole_start + hole->hole_size;
-		u64 adj_start, adj_end;
-		u64 col_start, col_end;
 
 		if (mode == DRM_MM_INSERT_LOW && hole_start >= range_end)
 			break;
@@ -568,60 +755,10 @@ int drm_mm_insert_node_in_range(struct drm_mm * const mm,
 		if (mode == DRM_MM_INSERT_HIGH && hole_end <= range_start)
 			break;
 
-		col_start = hole_start;
-		col_end = hole_end;
-		if (mm->color_adjust)
-			mm->color_adjust(hole, color, &col_start, &col_end);
-
-		adj_start = max(col_start, range_start);
-		adj_end = min(col_end, range_end);
-
-		if (adj_end <= adj_start || adj_end - adj_start < size)
-			continue;
-
-		if (mode == DRM_MM_INSERT_HIGH)
-			adj_start = adj_end - size;
-
-		if (alignment) {
-			u64 rem;
-
-			if (likely(remainder_mask))
-				rem = adj_start & remainder_mask;
-			else
-				div64_u64_rem(adj_start, alignment, &rem);
-			if (rem) {
-				adj_start -= rem;
-				if (mode != DRM_MM_INSERT_HIGH)
-					adj_start += alignment;
-
-				if (adj_start < max(col_start, range_start) ||
-				    min(col_end, range_end) - adj_start < size)
-					continue;
-
-				if (adj_end <= adj_start ||
-				    adj_end - adj_start < size)
-					continue;
-			}
-		}
-
-		node->mm = mm;
-		node->size = size;
-		node->start = adj_start;
-		node->color = color;
-		node->hole_size = 0;
-
-		__set_bit(DRM_MM_NODE_ALLOCATED_BIT, &node->flags);
-		list_add(&node->node_list, &hole->node_list);
-		drm_mm_interval_tree_add_node(hole, node);
-
-		rm_hole(hole);
-		if (adj_start > hole_start)
-			add_hole(hole);
-		if (adj_start + size < hole_end)
-			add_hole(node);
-
-		save_stack(node);
-		return 0;
+		if (!insert_into_hole(mm, node, hole, size,
+				      alignment, remainder_mask, color,
+				      range_start, range_end, mode))
+			return 0;
 	}
 
 	return -ENOSPC;
@@ -137,6 +137,18 @@
  * the Vulkan timeline semaphore API.
  *
  *
+ * Batched host-side operations
+ * ----------------------------
+ *
+ * &DRM_IOCTL_SYNCOBJ_OPS takes an array of struct &drm_syncobj_op and
+ * executes them in order. Each entry signals, resets, queries or transfers
+ * a point, mirroring &DRM_IOCTL_SYNCOBJ_SIGNAL,
+ * &DRM_IOCTL_SYNCOBJ_TIMELINE_SIGNAL, &DRM_IOCTL_SYNCOBJ_RESET,
+ * &DRM_IOCTL_SYNCOBJ_QUERY and &DRM_IOCTL_SYNCOBJ_TRANSFER, so that a
+ * submission thread can do all of its host-side syncobj work in one call.
+ * Query results are written back to the point field of their entry.
+ *
+ *
  * Import/export of syncobjs
  * -------------------------
  *
@@ -186,6 +198,7 @@
 #include <linux/anon_inodes.h>
 #include <linux/file.h>
 #include <linux/fs.h>
+#include <linux/llist.h>
 #include <linux/sched/signal.h>
 #include <linux/sync_file.h>
 #include <linux/uaccess.h>
@@ -200,12 +213,19 @@
 
 #include "drm_internal.h"
 
+struct syncobj_wait_state;
+
 struct syncobj_wait_entry {
 	struct list_head node;
 	struct task_struct *task;
 	struct dma_fence *fence;
 	struct dma_fence_cb fence_cb;
 	u64    point;
+
+	/* Only used by drm_syncobj_array_wait_timeout() */
+	struct syncobj_wait_state *state;
+	struct llist_node arrived;
+	u32 index;
 };
 
 static void syncobj_wait_syncobj_func(struct drm_syncobj *syncobj,
@@ -360,33 +380,14 @@ static void drm_syncobj_assign_null_handle(struct drm_syncobj *syncobj)
 
 /* 5s default for wait submission */
 #define DRM_SYNCOBJ_WAIT_FOR_SUBMIT_TIMEOUT 5000000000ULL
-/**
- * drm_syncobj_find_fence - lookup and reference the fence in a sync object
- * @file_private: drm file private pointer
- * @handle: sync object handle to lookup.
- * @point: timeline point
- * @flags: DRM_SYNCOBJ_WAIT_FLAGS_WAIT_FOR_SUBMIT or not
- * @fence: out parameter for the fence
- *
- * This is just a convenience function that combines drm_syncobj_find() and
- * drm_syncobj_fence_get().
- *
- * Returns 0 on success or a negative error value on failure. On success @fence
- * contains a reference to the fence, which must be released by calling
- * dma_fence_put().
- */
-int drm_syncobj_find_fence(struct drm_file *file_private,
-			   u32 handle, u64 point, u64 flags,
-			   struct dma_fence **fence)
+static int drm_syncobj_point_fence(struct drm_syncobj *syncobj,
+				   u64 point, u64 flags,
+				   struct dma_fence **fence)
 {
-	struct drm_syncobj *syncobj = drm_syncobj_find(file_private, handle);
 	struct syncobj_wait_entry wait;
 	u64 timeout = nsecs_to_jiffies64(DRM_SYNCOBJ_WAIT_FOR_SUBMIT_TIMEOUT);
 	int ret;
 
-	if (!syncobj)
-		return -ENOENT;
-
 	*fence = drm_syncobj_fence_get(syncobj);
 
 	if (*fence) {
@@ -432,6 +433,35 @@ int drm_syncobj_find_fence(struct drm_file *file_private,
 		drm_syncobj_remove_wait(syncobj, &wait);
 
 out:
+	return ret;
+}
+
+/**
+ * drm_syncobj_find_fence - lookup and reference the fence in a sync object
+ * @file_private: drm file private pointer
+ * @handle: sync object handle to lookup.
+ * @point: timeline point
+ * @flags: DRM_SYNCOBJ_WAIT_FLAGS_WAIT_FOR_SUBMIT or not
+ * @fence: out parameter for the fence
+ *
+ * This is just a convenience function that combines drm_syncobj_find() and
+ * drm_syncobj_fence_get().
+ *
+ * Returns 0 on success or a negative error value on failure. On success @fence
+ * contains a reference to the fence, which must be released by calling
+ * dma_fence_put().
+ */
+int drm_syncobj_find_fence(struct drm_file *file_private,
+			   u32 handle, u64 point, u64 flags,
+			   struct dma_fence **fence)
+{
+	struct drm_syncobj *syncobj = drm_syncobj_find(file_private, handle);
+	int ret;
+
+	if (!syncobj)
+		return -ENOENT;
+
+	ret = drm_syncobj_point_fence(syncobj, point, flags, fence);
 	drm_syncobj_put(syncobj);
 
 	return ret;
@@ -846,7 +876,7 @@ static int drm_syncobj_transfer_to_timeline(struct drm_file *file_private,
 				     &fence);
 	if (ret)
 		goto err;
-	chain = kzalloc(sizeof(struct dma_fence_chain), GFP_KERNEL);
+	chain = dma_fence_chain_alloc();
 	if (!chain) {
 		ret = -ENOMEM;
 		goto err1;
@@ -903,13 +933,61 @@ drm_syncobj_transfer_ioctl(struct drm_device *dev, void *data,
 	return ret;
 }
 
+/*
+ * Shared state of an array wait. Fence callbacks account for their own
+ * entry, so the waiter only has to look at two counters when it wakes
+ * up instead of rescanning every entry.
+ */
+struct syncobj_wait_state {
+	struct task_struct *task;
+	/* entries whose fence was attached after the wait started */
+	struct llist_head arrived;
+	/* entries that have not signaled yet */
+	atomic_t remaining;
+	/* index of the first entry to signal, or -1 */
+	atomic_t first;
+	bool wait_all;
+};
+
+static bool syncobj_wait_state_done(struct syncobj_wait_state *state)
+{
+	if (atomic_read(&state->remaining) == 0)
+		return true;
+	return !state->wait_all && atomic_read(&state->first) >= 0;
+}
+
+static void syncobj_wait_entry_signaled(struct syncobj_wait_entry *wait)
+{
+	struct syncobj_wait_state *state = wait->state;
+
+	atomic_cmpxchg(&state->first, -1, wait->index);
+	if (atomic_dec_and_test(&state->remaining) || !state->wait_all)
+		wake_up_process(state->task);
+}
+
 static void syncobj_wait_fence_func(struct dma_fence *fence,
 				    struct dma_fence_cb *cb)
 {
 	struct syncobj_wait_entry *wait =
 		container_of(cb, struct syncobj_wait_entry, fence_cb);
 
-	wake_up_process(wait->task);
+	if (wait->state)
+		syncobj_wait_entry_signaled(wait);
+	else
+		wake_up_process(wait->task);
+}
+
+/*
+ * Start tracking an entry which has a fence. Each entry is accounted
+ * exactly once, either here or from its fence callback.
+ */
+static void syncobj_wait_entry_arm(struct syncobj_wait_entry *wait,
+				   uint32_t flags)
+{
+	if ((flags & DRM_SYNCOBJ_WAIT_FLAGS_WAIT_AVAILABLE) ||
+	    dma_fence_add_callback(wait->fence, &wait->fence_cb,
+				   syncobj_wait_fence_func))
+		syncobj_wait_entry_signaled(wait);
 }
 
 static void syncobj_wait_syncobj_func(struct drm_syncobj *syncobj,
@@ -930,6 +1008,9 @@ static void syncobj_wait_syncobj_func(struct drm_syncobj *syncobj,
 		wait->fence = fence;
 	}
 
+	/* Let the array waiter arm the new fence outside of our lock */
+	if (wait->state)
+		llist_add(&wait->arrived, &wait->state->arrived);
 	wake_up_process(wait->task);
 	list_del_init(&wait->node);
 }
@@ -941,8 +1022,9 @@ static signed long drm_syncobj_array_wait_timeout(struct drm_syncobj **syncobjs,
 						  signed long timeout,
 						  uint32_t *idx)
 {
-	struct syncobj_wait_entry *entries;
-	struct dma_fence *fence;
+	struct syncobj_wait_entry *entries, *wait, *next;
+	struct syncobj_wait_state state;
+	struct llist_node *arrived;
 	uint64_t *points;
 	uint32_t signaled_count, i;
 
@@ -964,6 +1046,13 @@ static signed long drm_syncobj_array_wait_timeout(struct drm_syncobj **syncobjs,
 		timeout = -ENOMEM;
 		goto err_free_points;
 	}
+
+	state.task = current;
+	init_llist_head(&state.arrived);
+	atomic_set(&state.remaining, count);
+	atomic_set(&state.first, -1);
+	state.wait_all = flags & DRM_SYNCOBJ_WAIT_FLAGS_WAIT_ALL;
+
 	/* Walk the list of sync objects and initialize entries.  We do
 	 * this up-front so that we can properly return -EINVAL if there is
 	 * a syncobj with a missing fence and then never have the chance of
@@ -975,6 +1064,8 @@ static signed long drm_syncobj_array_wait_timeout(struct drm_syncobj **syncobjs,
 
 		entries[i].task = current;
 		entries[i].point = points[i];
+		entries[i].state = &state;
+		entries[i].index = i;
 		fence = drm_syncobj_fence_get(syncobjs[i]);
 		if (!fence || dma_fence_chain_find_seqno(&fence, points[i])) {
 			dma_fence_put(fence);
@@ -1004,49 +1095,48 @@ static signed long drm_syncobj_array_wait_timeout(struct drm_syncobj **syncobjs,
 	     !(flags & DRM_SYNCOBJ_WAIT_FLAGS_WAIT_ALL)))
 		goto cleanup_entries;
 
-	/* There's a very annoying laxness in the dma_fence API here, in
-	 * that backends are not required to automatically report when a
-	 * fence is signaled prior to fence->ops->enable_signaling() being
-	 * called.  So here if we fail to match signaled_count, we need to
-	 * fallthough and try a 0 timeout wait!
+	/* From here on every entry is accounted for by its fence callback
+	 * (or right away if the fence is already signaled), so a wakeup
+	 * only needs to look at the counters in the wait state instead of
+	 * rescanning all of the entries.
 	 */
-
-	if (flags & DRM_SYNCOBJ_WAIT_FLAGS_WAIT_FOR_SUBMIT) {
-		for (i = 0; i < count; ++i)
-			drm_syncobj_fence_add_wait(syncobjs[i], &entries[i]);
+	for (i = 0; i < count; ++i) {
+		wait = &entries[i];
+		if (!wait->fence &&
+		    (flags & DRM_SYNCOBJ_WAIT_FLAGS_WAIT_FOR_SUBMIT))
+			drm_syncobj_fence_add_wait(syncobjs[i], wait);
+		/* Entries still without a fence show up on state.arrived */
+		if (wait->fence && !wait->node.next)
+			syncobj_wait_entry_arm(wait, flags);
+		if (syncobj_wait_state_done(&state))
+			goto done_waiting;
 	}
 
 	do {
 		set_current_state(TASK_INTERRUPTIBLE);
 
-		signaled_count = 0;
-		for (i = 0; i < count; ++i) {
-			fence = entries[i].fence;
-			if (!fence)
-				continue;
-
-			if ((flags & DRM_SYNCOBJ_WAIT_FLAGS_WAIT_AVAILABLE) ||
-			    dma_fence_is_signaled(fence) ||
-			    (!entries[i].fence_cb.func &&
-			     dma_fence_add_callback(fence,
-						    &entries[i].fence_cb,
-						    syncobj_wait_fence_func))) {
-				/* The fence has been signaled */
-				if (flags & DRM_SYNCOBJ_WAIT_FLAGS_WAIT_ALL) {
-					signaled_count++;
-				} else {
-					if (idx)
-						*idx = i;
-					goto done_waiting;
-				}
-			}
-		}
+		arrived = llist_del_all(&state.arrived);
+		llist_for_each_entry_safe(wait, next, arrived, arrived)
+			syncobj_wait_entry_arm(wait, flags);
 
-		if (signaled_count == count)
+		if (syncobj_wait_state_done(&state))
 			goto done_waiting;
 
 		if (timeout == 0) {
-			timeout = -ETIME;
+			/* There's a very annoying laxness in the dma_fence
+			 * API here, in that backends are not required to
+			 * automatically report when a fence is signaled
+			 * prior to fence->ops->enable_signaling() being
+			 * called.  So poll every fence one last time before
+			 * giving up, which signals the fence and runs our
+			 * callback if it has completed.
+			 */
+			for (i = 0; i < count; ++i) {
+				if (entries[i].fence_cb.func)
+					dma_fence_is_signaled(entries[i].fence);
+			}
+			if (!syncobj_wait_state_done(&state))
+				timeout = -ETIME;
 			goto done_waiting;
 		}
 
@@ -1060,6 +1150,8 @@ static signed long drm_syncobj_array_wait_timeout(struct drm_syncobj **syncobjs,
 
 done_waiting:
 	__set_current_state(TASK_RUNNING);
+	if (idx && atomic_read(&state.first) >= 0)
+		*idx = atomic_read(&state.first);
 
 cleanup_entries:
 	for (i = 0; i < count; ++i) {
@@ -1143,12 +1235,40 @@ static int drm_syncobj_array_wait(struct drm_device *dev,
 	return 0;
 }
 
+/*
+ * Look up and reference every handle of the array while holding the table
+ * lock only once, instead of once per handle.
+ */
+static int drm_syncobj_array_lookup(struct drm_file *file_private,
+				    const uint32_t *handles,
+				    uint32_t count_handles,
+				    struct drm_syncobj **syncobjs)
+{
+	uint32_t i;
+
+	spin_lock(&file_private->syncobj_table_lock);
+	for (i = 0; i < count_handles; i++) {
+		syncobjs[i] = idr_find(&file_private->syncobj_idr, handles[i]);
+		if (!syncobjs[i])
+			break;
+		drm_syncobj_get(syncobjs[i]);
+	}
+	spin_unlock(&file_private->syncobj_table_lock);
+
+	if (i == count_handles)
+		return 0;
+
+	while (i-- > 0)
+		drm_syncobj_put(syncobjs[i]);
+	return -ENOENT;
+}
+
 static int drm_syncobj_array_find(struct drm_file *file_private,
 				  void __user *user_handles,
 				  uint32_t count_handles,
 				  struct drm_syncobj ***syncobjs_out)
 {
-	uint32_t i, *handles;
+	uint32_t *handles;
 	struct drm_syncobj **syncobjs;
 	int ret;
 
@@ -1168,22 +1288,17 @@ static int drm_syncobj_array_find(struct drm_file *file_private,
 		goto err_free_handles;
 	}
 
-	for (i = 0; i < count_handles; i++) {
-		syncobjs[i] = drm_syncobj_find(file_private, handles[i]);
-		if (!syncobjs[i]) {
-			ret = -ENOENT;
-			goto err_put_syncobjs;
-		}
+	ret = drm_syncobj_array_lookup(file_private, handles, count_handles,
+				       syncobjs);
+	if (ret) {
+		kfree(syncobjs);
+		goto err_free_handles;
 	}
 
 	kfree(handles);
 	*syncobjs_out = syncobjs;
 	return 0;
 
-err_put_syncobjs:
-	while (i-- > 0)
-		drm_syncobj_put(syncobjs[i]);
-	kfree(syncobjs);
 err_free_handles:
 	kfree(handles);
 
@@ -1381,10 +1496,10 @@ drm_syncobj_timeline_signal_ioctl(struct drm_device *dev, void *data,
 		goto err_points;
 	}
 	for (i = 0; i < args->count_handles; i++) {
-		chains[i] = kzalloc(sizeof(struct dma_fence_chain), GFP_KERNEL);
+		chains[i] = dma_fence_chain_alloc();
 		if (!chains[i]) {
 			for (j = 0; j < i; j++)
-				kfree(chains[j]);
+				dma_fence_chain_free(chains[j]);
 			ret = -ENOMEM;
 			goto err_chains;
 		}
@@ -1407,6 +1522,45 @@ out:
 	return ret;
 }
 
+static uint64_t drm_syncobj_query_point(struct drm_syncobj *syncobj,
+				       uint32_t flags)
+{
+	struct dma_fence_chain *chain;
+	struct dma_fence *fence;
+	uint64_t point;
+
+	fence = drm_syncobj_fence_get(syncobj);
+	chain = to_dma_fence_chain(fence);
+	if (chain) {
+		struct dma_fence *iter, *last_signaled =
+			dma_fence_get(fence);
+
+		if (flags & DRM_SYNCOBJ_QUERY_FLAGS_LAST_SUBMITTED) {
+			point = fence->seqno;
+		} else {
+			dma_fence_chain_for_each(iter, fence) {
+				if (iter->context != fence->context) {
+					dma_fence_put(iter);
+					/* It is most likely that timeline has
+					* unorder points. */
+					break;
+				}
+				dma_fence_put(last_signaled);
+				last_signaled = dma_fence_get(iter);
+			}
+			point = dma_fence_is_signaled(last_signaled) ?
+				last_signaled->seqno :
+				to_dma_fence_chain(last_signaled)->prev_seqno;
+		}
+		dma_fence_put(last_signaled);
+	} else {
+		point = 0;
+	}
+	dma_fence_put(fence);
+
+	return point;
+}
+
 int drm_syncobj_query_ioctl(struct drm_device *dev, void *data,
 			    struct drm_file *file_private)
 {
@@ -1433,39 +1587,9 @@ int drm_syncobj_query_ioctl(struct drm_device *dev, void *data,
 		return ret;
 
 	for (i = 0; i < args->count_handles; i++) {
-		struct dma_fence_chain *chain;
-		struct dma_fence *fence;
 		uint64_t point;
 
-		fence = drm_syncobj_fence_get(syncobjs[i]);
-		chain = to_dma_fence_chain(fence);
-		if (chain) {
-			struct dma_fence *iter, *last_signaled =
-				dma_fence_get(fence);
-
-			if (args->flags &
-			    DRM_SYNCOBJ_QUERY_FLAGS_LAST_SUBMITTED) {
-				point = fence->seqno;
-			} else {
-				dma_fence_chain_for_each(iter, fence) {
-					if (iter->context != fence->context) {
-						dma_fence_put(iter);
-						/* It is most likely that timeline has
-						* unorder points. */
-						break;
-					}
-					dma_fence_put(last_signaled);
-					last_signaled = dma_fence_get(iter);
-				}
-				point = dma_fence_is_signaled(last_signaled) ?
-					last_signaled->seqno :
-					to_dma_fence_chain(last_signaled)->prev_seqno;
-			}
-			dma_fence_put(last_signaled);
-		} else {
-			point = 0;
-		}
-		dma_fence_put(fence);
+		point = drm_syncobj_query_point(syncobjs[i], args->flags);
 		ret = copy_to_user(&points[i], &point, sizeof(uint64_t));
 		ret = ret ? -EFAULT : 0;
 		if (ret)
@@ -1475,3 +1599,198 @@ int drm_syncobj_query_ioctl(struct drm_device *dev, void *data,
 
 	return ret;
 }
+
+static int drm_syncobj_op_check(struct drm_device *dev,
+				const struct drm_syncobj_op *op)
+{
+	switch (op->op) {
+	case DRM_SYNCOBJ_OP_SIGNAL:
+		if (op->flags || op->src_handle || op->src_point)
+			return -EINVAL;
+		break;
+	case DRM_SYNCOBJ_OP_RESET:
+		if (op->point || op->flags || op->src_handle || op->src_point)
+			return -EINVAL;
+		return 0;
+	case DRM_SYNCOBJ_OP_QUERY:
+		if (op->flags & ~DRM_SYNCOBJ_QUERY_FLAGS_LAST_SUBMITTED ||
+		    op->src_handle || op->src_point)
+			return -EINVAL;
+		break;
+	case DRM_SYNCOBJ_OP_TRANSFER:
+		if (op->flags & ~DRM_SYNCOBJ_WAIT_FLAGS_WAIT_FOR_SUBMIT)
+			return -EINVAL;
+		break;
+	default:
+		return -EINVAL;
+	}
+
+	if ((op->point || op->op != DRM_SYNCOBJ_OP_SIGNAL) &&
+	    !drm_core_check_feature(dev, DRIVER_SYNCOBJ_TIMELINE))
+		return -EOPNOTSUPP;
+
+	return 0;
+}
+
+/*
+ * Execute a vector of signal, reset, query and transfer operations. The
+ * operations are copied in once, validated, and all of their handles are
+ * resolved under a single acquisition of the handle table lock. Chain nodes
+ * for new timeline points are allocated up front so that the operations
+ * themselves cannot fail on memory. Only transfers, which may have to wait
+ * for a fence to materialize, can fail midway. As the operations before it
+ * have already been applied the ioctl then succeeds, with count_done telling
+ * how many were executed and error why the rest was not; the ioctl data is
+ * only copied back to userspace on success.
+ */
+int
+drm_syncobj_ops_ioctl(struct drm_device *dev, void *data,
+		      struct drm_file *file_private)
+{
+	struct drm_syncobj_op_array *args = data;
+	struct drm_syncobj_op *ops;
+	struct drm_syncobj **syncobjs;
+	struct dma_fence_chain **chains;
+	struct dma_fence *fence;
+	uint32_t *handles;
+	uint32_t i, src, count, nchains, c;
+	bool query = false;
+	int ret;
+
+	if (!drm_core_check_feature(dev, DRIVER_SYNCOBJ))
+		return -EOPNOTSUPP;
+
+	if (args->flags != 0)
+		return -EINVAL;
+
+	if (args->count_ops == 0)
+		return -EINVAL;
+
+	args->count_done = 0;
+	args->error = 0;
+
+	ops = kmalloc_array(args->count_ops, sizeof(*ops), GFP_KERNEL);
+	if (!ops)
+		return -ENOMEM;
+
+	if (copy_from_user(ops, u64_to_user_ptr(args->ops),
+			   sizeof(*ops) * args->count_ops)) {
+		ret = -EFAULT;
+		goto err_free_ops;
+	}
+
+	/* One handle per operation, followed by the transfer sources */
+	count = args->count_ops;
+	nchains = 0;
+	for (i = 0; i < args->count_ops; i++) {
+		ret = drm_syncobj_op_check(dev, &ops[i]);
+		if (ret)
+			goto err_free_ops;
+
+		if (ops[i].op == DRM_SYNCOBJ_OP_TRANSFER)
+			count++;
+		if (ops[i].op == DRM_SYNCOBJ_OP_QUERY)
+			query = true;
+		else if (ops[i].op != DRM_SYNCOBJ_OP_RESET && ops[i].point)
+			nchains++;
+	}
+
+	handles = kmalloc_array(count, sizeof(*handles), GFP_KERNEL);
+	syncobjs = kmalloc_array(count, sizeof(*syncobjs), GFP_KERNEL);
+	chains = kmalloc_array(max(nchains, 1u), sizeof(*chains), GFP_KERNEL);
+	if (!handles || !syncobjs || !chains) {
+		ret = -ENOMEM;
+		goto err_free_arrays;
+	}
+
+	src = args->count_ops;
+	for (i = 0; i < args->count_ops; i++) {
+		handles[i] = ops[i].handle;
+		if (ops[i].op == DRM_SYNCOBJ_OP_TRANSFER)
+			handles[src++] = ops[i].src_handle;
+	}
+
+	ret = drm_syncobj_array_lookup(file_private, handles, count, syncobjs);
+	if (ret)
+		goto err_free_arrays;
+
+	for (c = 0; c < nchains; c++) {
+		chains[c] = dma_fence_chain_alloc();
+		if (!chains[c]) {
+			while (c-- > 0)
+				dma_fence_chain_free(chains[c]);
+			ret = -ENOMEM;
+			goto err_put_syncobjs;
+		}
+	}
+
+	c = 0;
+	src = args->count_ops;
+	for (i = 0; i < args->count_ops; i++) {
+		struct drm_syncobj *syncobj = syncobjs[i];
+		struct drm_syncobj_op *op = &ops[i];
+
+		switch (op->op) {
+		case DRM_SYNCOBJ_OP_SIGNAL:
+			if (!op->point) {
+				drm_syncobj_assign_null_handle(syncobj);
+				break;
+			}
+			fence = dma_fence_get_stub();
+			drm_syncobj_add_point(syncobj, chains[c++], fence,
+					      op->point);
+			dma_fence_put(fence);
+			break;
+		case DRM_SYNCOBJ_OP_RESET:
+			drm_syncobj_replace_fence(syncobj, NULL);
+			break;
+		case DRM_SYNCOBJ_OP_QUERY:
+			op->point = drm_syncobj_query_point(syncobj, op->flags);
+			break;
+		case DRM_SYNCOBJ_OP_TRANSFER:
+			ret = drm_syncobj_point_fence(syncobjs[src++],
+						      op->src_point, op->flags,
+						      &fence);
+			if (ret)
+				goto done;
+			if (op->point)
+				drm_syncobj_add_point(syncobj, chains[c++],
+						      fence, op->point);
+			else
+				drm_syncobj_replace_fence(syncobj, fence);
+			dma_fence_put(fence);
+			break;
+		}
+		args->count_done++;
+	}
+
+done:
+	if (query &&
+	    copy_to_user(u64_to_user_ptr(args->ops), ops,
+			 sizeof(*ops) * args->count_done))
+		ret = -EFAULT;
+
+	/*
+	 * Once something has been applied userspace needs count_done, which
+	 * only reaches it on success. Without progress the error is returned
+	 * as is, so that the call can simply be restarted.
+	 */
+	if (ret && args->count_done) {
+		args->error = ret == -ERESTARTSYS ? -EINTR : ret;
+		ret = 0;
+	}
+
+	while (c < nchains)
+		dma_fence_chain_free(chains[c++]);
+err_put_syncobjs:
+	for (i = 0; i < count; i++)
+		drm_syncobj_put(syncobjs[i]);
+err_free_arrays:
+	kfree(chains);
+	kfree(syncobjs);
+	kfree(handles);
+err_free_ops:
+	kfree(ops);
+
+	return ret;
+}
@@ -65,7 +65,22 @@
  * open-file with the offset of the node will fail with -EACCES. To revoke
  * access again, use drm_vma_node_revoke(). However, the caller is responsible
  * for destroying already existing mappings, if required.
+ *
+ * Both the offset tree and the per-node list of open-files can be searched
+ * without taking any shared lock. Writers bump a sequence count while they
+ * modify a tree and readers walk it under RCU, only falling back to the locks
+ * if the walk raced with a writer. For the access list this is transparent,
+ * entries are freed after a grace period. drm_vma_offset_lookup_rcu() however
+ * hands out nodes embedded in driver objects, so it may only be used by
+ * drivers which keep their nodes around for a grace period after
+ * drm_vma_offset_remove(), e.g. by freeing their objects through RCU.
+ */
+
+/*
+ * A red-black tree never gets deeper than twice the log of its size, a longer
+ * lockless walk has been sent in circles by a concurrent rebalance.
  */
+#define DRM_VMA_MAX_DEPTH (2 * BITS_PER_LONG)
 
 /**
  * drm_vma_offset_manager_init - Initialize new offset-manager
@@ -86,6 +101,7 @@ void drm_vma_offset_manager_init(struct drm_vma_offset_manager *mgr,
 				 unsigned long page_offset, unsigned long size)
 {
 	rwlock_init(&mgr->vm_lock);
+	seqcount_init(&mgr->vm_seq);
 	drm_mm_init(&mgr->vm_addr_space_mm, page_offset, size);
 }
 EXPORT_SYMBOL(drm_vma_offset_manager_init);
@@ -137,44 +153,97 @@ EXPORT_SYMBOL(drm_vma_offset_manager_destroy);
  * is returned. It's the caller's responsibility to make sure the node doesn't
  * get destroyed before the caller can access it.
  */
-struct drm_vma_offset_node *drm_vma_offset_lookup_locked(struct drm_vma_offset_manager *mgr,
-							 unsigned long start,
-							 unsigned long pages)
+static bool drm_vma_offset_walk(struct drm_vma_offset_manager *mgr,
+				unsigned long start, unsigned long pages,
+				unsigned int max_depth,
+				struct drm_vma_offset_node **out)
 {
 	struct drm_mm_node *node, *best;
 	struct rb_node *iter;
 	unsigned long offset;
 
-	iter = mgr->vm_addr_space_mm.interval_tree.rb_root.rb_node;
+	iter = READ_ONCE(mgr->vm_addr_space_mm.interval_tree.rb_root.rb_node);
 	best = NULL;
 
 	while (likely(iter)) {
+		if (unlikely(!max_depth--))
+			return false;
+
 		node = rb_entry(iter, struct drm_mm_node, rb);
-		offset = node->start;
+		offset = READ_ONCE(node->start);
 		if (start >= offset) {
-			iter = iter->rb_right;
+			iter = READ_ONCE(iter->rb_right);
 			best = node;
 			if (start == offset)
 				break;
 		} else {
-			iter = iter->rb_left;
+			iter = READ_ONCE(iter->rb_left);
 		}
 	}
 
 	/* verify that the node spans the requested area */
 	if (best) {
-		offset = best->start + best->size;
+		offset = READ_ONCE(best->start) + READ_ONCE(best->size);
 		if (offset < start + pages)
 			best = NULL;
 	}
 
-	if (!best)
-		return NULL;
+	*out = best ? container_of(best, struct drm_vma_offset_node, vm_node) :
+		      NULL;
+	return true;
+}
+
+struct drm_vma_offset_node *drm_vma_offset_lookup_locked(struct drm_vma_offset_manager *mgr,
+							 unsigned long start,
+							 unsigned long pages)
+{
+	struct drm_vma_offset_node *node;
 
-	return container_of(best, struct drm_vma_offset_node, vm_node);
+	drm_vma_offset_walk(mgr, start, pages, UINT_MAX, &node);
+	return node;
 }
 EXPORT_SYMBOL(drm_vma_offset_lookup_locked);
 
+/**
+ * drm_vma_offset_lookup_rcu() - Find node in offset space without locking
+ * @mgr: Manager object
+ * @start: Start address for object (page-based)
+ * @pages: Size of object (page-based)
+ *
+ * Same as drm_vma_offset_lookup_locked() but must be called from within an
+ * RCU read-side critical section instead of holding the lookup lock. The
+ * manager lock is only taken if the lockless walk raced with an update.
+ *
+ * This may only be used if nodes removed with drm_vma_offset_remove() stay
+ * valid for an RCU grace period, see the DOC section above. The returned node
+ * can be released concurrently, so the caller has to take a weak reference
+ * like kref_get_unless_zero() on the object before leaving the RCU section.
+ *
+ * RETURNS:
+ * Returns NULL if no suitable node can be found. Otherwise, the best match
+ * is returned.
+ */
+struct drm_vma_offset_node *drm_vma_offset_lookup_rcu(struct drm_vma_offset_manager *mgr,
+						      unsigned long start,
+						      unsigned long pages)
+{
+	struct drm_vma_offset_node *node;
+	unsigned int seq;
+
+	seq = read_seqcount_begin(&mgr->vm_seq);
+	if (likely(drm_vma_offset_walk(mgr, start, pages, DRM_VMA_MAX_DEPTH,
+				       &node) &&
+		   !read_seqcount_retry(&mgr->vm_seq, seq)))
+		return node;
+
+	read_lock(&mgr->vm_lock);
+	node = drm_vma_offset_lookup_locked(mgr, start, pages);
+	read_unlock(&mgr->vm_lock);
+
+	return node;
+}
+EXPORT_SYMBOL(drm_vma_offset_lookup_rcu);
+
 /**
  * drm_vma_offset_add() - Add offset node to manager
  * @mgr: Manager object
@@ -205,9 +274,12 @@ int drm_vma_offset_add(struct drm_vma_offset_manager *mgr,
 
 	write_lock(&mgr->vm_lock);
 
-	if (!drm_mm_node_allocated(&node->vm_node))
+	if (!drm_mm_node_allocated(&node->vm_node)) {
+		write_seqcount_begin(&mgr->vm_seq);
 		ret = drm_mm_insert_node(&mgr->vm_addr_space_mm,
 					 &node->vm_node, pages);
+		write_seqcount_end(&mgr->vm_seq);
+	}
 
 	write_unlock(&mgr->vm_lock);
 
@@ -232,8 +304,10 @@ void drm_vma_offset_remove(struct drm_vma_offset_manager *mgr,
 	write_lock(&mgr->vm_lock);
 
 	if (drm_mm_node_allocated(&node->vm_node)) {
+		write_seqcount_begin(&mgr->vm_seq);
 		drm_mm_remove_node(&node->vm_node);
 		memset(&node->vm_node, 0, sizeof(node->vm_node));
+		write_seqcount_end(&mgr->vm_seq);
 	}
 
 	write_unlock(&mgr->vm_lock);
@@ -270,8 +344,9 @@ int drm_vma_node_allow(struct drm_vma_offset_node *node, struct drm_file *tag)
 	/* Preallocate entry to avoid atomic allocations below. It is quite
 	 * unlikely that an open-file is added twice to a single node so we
 	 * don't optimize for this case. OOM is checked below only if the entry
-	 * is actually used. */
-	new = kmalloc(sizeof(*entry), GFP_KERNEL);
+	 * is actually used. Lockless readers may see the entry as soon as it is
+	 * linked, so make sure it doesn't contain stale pointers. */
+	new = kzalloc(sizeof(*entry), GFP_KERNEL);
 
 	write_lock(&node->vm_lock);
 
@@ -298,8 +373,10 @@ int drm_vma_node_allow(struct drm_vma_offset_node *node, struct drm_file *tag)
 
 	new->vm_tag = tag;
 	new->vm_count = 1;
+	write_seqcount_begin(&node->vm_seq);
 	rb_link_node(&new->vm_rb, parent, iter);
 	rb_insert_color(&new->vm_rb, &node->vm_files);
+	write_seqcount_end(&node->vm_seq);
 	new = NULL;
 
 unlock:
@@ -335,8 +412,10 @@ void drm_vma_node_revoke(struct drm_vma_offset_node *node,
 		entry = rb_entry(iter, struct drm_vma_offset_file, vm_rb);
 		if (tag == entry->vm_tag) {
 			if (!--entry->vm_count) {
+				write_seqcount_begin(&node->vm_seq);
 				rb_erase(&entry->vm_rb, &node->vm_files);
-				kfree(entry);
+				write_seqcount_end(&node->vm_seq);
+				kfree_rcu(entry, vm_rcu);
 			}
 			break;
 		} else if (tag > entry->vm_tag) {
@@ -350,6 +429,31 @@ void drm_vma_node_revoke(struct drm_vma_offset_node *node,
 }
 EXPORT_SYMBOL(drm_vma_node_revoke);
 
+static bool drm_vma_node_find_file(struct drm_vma_offset_node *node,
+				   struct drm_file *tag,
+				   unsigned int max_depth, bool *found)
+{
+	struct drm_vma_offset_file *entry;
+	struct rb_node *iter;
+
+	iter = READ_ONCE(node->vm_files.rb_node);
+	while (likely(iter)) {
+		if (unlikely(!max_depth--))
+			return false;
+
+		entry = rb_entry(iter, struct drm_vma_offset_file, vm_rb);
+		if (tag == entry->vm_tag)
+			break;
+		else if (tag > entry->vm_tag)
+			iter = READ_ONCE(iter->rb_right);
+		else
+			iter = READ_ONCE(iter->rb_left);
+	}
+
+	*found = iter;
+	return true;
+}
+
 /**
  * drm_vma_node_is_allowed - Check whether an open-file is granted access
  * @node: Node to check
@@ -358,7 +462,8 @@ EXPORT_SYMBOL(drm_vma_node_revoke);
  * Search the list in @node whether @tag is currently on the list of allowed
  * open-files (see drm_vma_node_allow()).
  *
- * This is locked against concurrent access internally.
+ * The list is searched under RCU, the node lock is only taken if that raced
+ * with a concurrent drm_vma_node_allow() or drm_vma_node_revoke().
  *
  * RETURNS:
  * true iff @filp is on the list
@@ -366,24 +471,23 @@ EXPORT_SYMBOL(drm_vma_node_revoke);
 bool drm_vma_node_is_allowed(struct drm_vma_offset_node *node,
 			     struct drm_file *tag)
 {
-	struct drm_vma_offset_file *entry;
-	struct rb_node *iter;
-
-	read_lock(&node->vm_lock);
-
-	iter = node->vm_files.rb_node;
-	while (likely(iter)) {
-		entry = rb_entry(iter, struct drm_vma_offset_file, vm_rb);
-		if (tag == entry->vm_tag)
-			break;
-		else if (tag > entry->vm_tag)
-			iter = iter->rb_right;
-		else
-			iter = iter->rb_left;
+	unsigned int seq;
+	bool found;
+
+	rcu_read_lock();
+	seq = read_seqcount_begin(&node->vm_seq);
+	if (likely(drm_vma_node_find_file(node, tag, DRM_VMA_MAX_DEPTH,
+					  &found) &&
+		   !read_seqcount_retry(&node->vm_seq, seq))) {
+		rcu_read_unlock();
+		return found;
 	}
+	rcu_read_unlock();
 
+	read_lock(&node->vm_lock);
+	drm_vma_node_find_file(node, tag, UINT_MAX, &found);
 	read_unlock(&node->vm_lock);
 
-	return iter;
+	return found;
 }
 EXPORT_SYMBOL(drm_vma_node_is_allowed);
@@ -102,6 +102,7 @@ void i915_lut_handle_free(struct i915_lut_handle *lut)
 
 static void lut_close(struct i915_gem_context *ctx)
 {
+	struct i915_gem_lut_cache *cache;
 	struct radix_tree_iter iter;
 	void __rcu **slot;
 
@@ -138,7 +139,15 @@ static void lut_close(struct i915_gem_context *ctx)
 		i915_gem_object_put(obj);
 	}
 	rcu_read_unlock();
+
+	/* Every vma in the execbuf cache has now been released */
+	WRITE_ONCE(ctx->lut_generation, ctx->lut_generation + 1);
+	cache = rcu_replace_pointer(ctx->lut_cache, NULL,
+				    lockdep_is_held(&ctx->lut_mutex));
 	mutex_unlock(&ctx->lut_mutex);
+
+	if (cache)
+		kfree_rcu(cache, rcu);
 }
 
 static struct intel_context *
@@ -27,9 +27,40 @@ struct pid;
 struct drm_i915_private;
 struct drm_i915_file_private;
 struct i915_address_space;
+struct i915_vma;
 struct intel_timeline;
 struct intel_ring;
 
+/**
+ * struct i915_gem_lut_cache - The handle to vma resolution of the last execbuf
+ *
+ * Clients tend to resubmit the same object list, so execbuf reuses @vma[i]
+ * for the i-th execobj whenever its handle matches @handle[i] instead of
+ * looking it up in &i915_gem_context.handles_vma. The cache holds no
+ * references of its own; it is only trusted while the context's
+ * lut_generation is unchanged, i.e. while every handle in it is still open
+ * and so still keeps its vma alive through handles_vma.
+ */
+struct i915_gem_lut_cache {
+	/** @rcu: rcu_head for deferred freeing */
+	struct rcu_head rcu;
+
+	/** @vm: the address space the vma were instanced in */
+	struct i915_address_space *vm;
+
+	/** @lut_generation: &i915_gem_context.lut_generation when built */
+	unsigned long lut_generation;
+
+	/** @count: number of entries in @handle and @vma */
+	unsigned int count;
+
+	/** @handle: user handles, in execobj order */
+	u32 *handle;
+
+	/** @vma: vma for each handle */
+	struct i915_vma *vma[];
+};
+
 /**
  * struct i915_gem_engines - A set of engines
  */
@@ -402,6 +433,18 @@ struct i915_gem_context {
 	/** @lut_mutex: Locks handles_vma */
 	struct mutex lut_mutex;
 
+	/**
+	 * @lut_generation: bumped under @lut_mutex whenever a handle is
+	 * removed from @handles_vma, invalidating @lut_cache
+	 */
+	unsigned long lut_generation;
+
+	/**
+	 * @lut_cache: handles resolved by the last execbuf, replaced under
+	 * @lut_mutex and read under RCU
+	 */
+	struct i915_gem_lut_cache __rcu *lut_cache;
+
 	/**
 	 * @name: arbitrary name, used for user debug
 	 *
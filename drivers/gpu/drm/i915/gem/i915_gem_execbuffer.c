@@ -6,6 +6,7 @@
 
 #include <linux/dma-resv.h>
 #include <linux/highmem.h>
+#include <linux/sort.h>
 #include <linux/sync_file.h>
 #include <linux/uaccess.h>
 
@@ -83,6 +84,8 @@ enum {
 
 #define BATCH_OFFSET_BIAS (256*1024)
 
+#define RELOC_BATCH 128 /* relocation writes queued per object */
+
 #define __I915_EXEC_ILLEGAL_FLAGS \
 	(__I915_EXEC_UNKNOWN_FLAGS | \
 	 I915_EXEC_CONSTANTS_MASK  | \
@@ -292,17 +295,28 @@ struct i915_execbuffer {
 	/**
 	 * Track the most recently used object for relocations, as we
 	 * frequently have to perform multiple relocations within the same
-	 * obj/page
+	 * obj/page. The writes for an object are queued and applied in
+	 * batches sorted by offset, see reloc_flush().
 	 */
 	struct reloc_cache {
 		struct drm_mm_node node; /** temporary GTT binding */
 		unsigned long vaddr; /** Current kmap address */
 		unsigned long page; /** Currently mapped page index */
+		unsigned long line; /** Written cacheline awaiting clflush */
+		struct reloc_write {
+			u64 offset; /** Location of the write within the obj */
+			u64 addr; /** Relocated address to write */
+			u64 presumed; /** Updated reloc.presumed_offset */
+			u64 __user *user; /** User's presumed_offset, or NULL */
+			unsigned int seq; /** Queue order, for equal offsets */
+		} *writes; /** Queue of RELOC_BATCH pending writes */
+		unsigned int nwrites; /** Number of queued writes */
 		unsigned int graphics_ver; /** Cached value of GRAPHICS_VER */
 		bool use_64bit_reloc : 1;
 		bool has_llc : 1;
 		bool has_fence : 1;
 		bool needs_unfenced : 1;
+		bool sorted : 1; /** Queued writes are in ascending order */
 	} reloc_cache;
 
 	u64 invalid_flags; /** Set of execobj.flags that are invalid */
@@ -904,17 +918,83 @@ static struct i915_vma *eb_lookup_vma(struct i915_execbuffer *eb, u32 handle)
 	} while (1);
 }
 
+static struct i915_vma *
+eb_lookup_cached_vma(struct i915_execbuffer *eb, unsigned int i)
+{
+	struct i915_gem_context *ctx = eb->gem_context;
+	struct i915_gem_lut_cache *cache;
+	struct i915_vma *vma = NULL;
+
+	/*
+	 * The cache is only valid while no handle has been closed since it
+	 * was built, as until then each of its vma is still kept alive by
+	 * handles_vma and no handle can have been reused for another object.
+	 */
+	rcu_read_lock();
+	cache = rcu_dereference(ctx->lut_cache);
+	if (cache && i < cache->count &&
+	    cache->handle[i] == eb->exec[i].handle &&
+	    cache->vm == eb->context->vm &&
+	    cache->lut_generation == READ_ONCE(ctx->lut_generation))
+		vma = i915_vma_tryget(cache->vma[i]);
+	rcu_read_unlock();
+
+	return vma;
+}
+
+static void eb_update_lut_cache(struct i915_execbuffer *eb, unsigned long gen)
+{
+	struct i915_gem_context *ctx = eb->gem_context;
+	struct i915_gem_lut_cache *cache;
+	unsigned int i;
+
+	/* Purely an optimisation, so don't try too hard */
+	cache = kmalloc(struct_size(cache, vma, eb->buffer_count) +
+			eb->buffer_count * sizeof(*cache->handle),
+			GFP_KERNEL | __GFP_NOWARN);
+	if (!cache)
+		return;
+
+	cache->vm = eb->context->vm;
+	cache->lut_generation = gen;
+	cache->count = eb->buffer_count;
+	cache->handle = (u32 *)&cache->vma[cache->count];
+	for (i = 0; i < cache->count; i++) {
+		cache->handle[i] = eb->exec[i].handle;
+		cache->vma[i] = eb->vma[i].vma;
+	}
+
+	/* A handle closed since @gen may have been reused, drop the cache */
+	if (!mutex_lock_interruptible(&ctx->lut_mutex)) {
+		if (gen == ctx->lut_generation)
+			cache = rcu_replace_pointer(ctx->lut_cache, cache,
+						    lockdep_is_held(&ctx->lut_mutex));
+		mutex_unlock(&ctx->lut_mutex);
+	}
+
+	if (cache)
+		kfree_rcu(cache, rcu);
+}
+
 static int eb_lookup_vmas(struct i915_execbuffer *eb)
 {
-	unsigned int i, current_batch = 0;
+	unsigned int i, current_batch = 0, hits = 0;
+	unsigned long gen;
 	int err = 0;
 
 	INIT_LIST_HEAD(&eb->relocs);
 
+	/* Sample before the lookups so that a racing close retires the cache */
+	gen = READ_ONCE(eb->gem_context->lut_generation);
+
 	for (i = 0; i < eb->buffer_count; i++) {
 		struct i915_vma *vma;
 
-		vma = eb_lookup_vma(eb, eb->exec[i].handle);
+		vma = eb_lookup_cached_vma(eb, i);
+		if (likely(vma))
+			hits++;
+		else
+			vma = eb_lookup_vma(eb, eb->exec[i].handle);
 		if (IS_ERR(vma)) {
 			err = PTR_ERR(vma);
 			goto err;
@@ -951,6 +1031,9 @@ static int eb_lookup_vmas(struct i915_execbuffer *eb)
 		}
 	}
 
+	if (hits < eb->buffer_count)
+		eb_update_lut_cache(eb, gen);
+
 	return 0;
 
 err:
@@ -1072,6 +1155,8 @@ static void eb_destroy(const struct i915_execbuffer *eb)
 {
 	if (eb->lut_size > 0)
 		kfree(eb->buckets);
+
+	kvfree(eb->reloc_cache.writes);
 }
 
 static inline u64
@@ -1086,6 +1171,10 @@ static void reloc_cache_init(struct reloc_cache *cache,
 {
 	cache->page = -1;
 	cache->vaddr = 0;
+	cache->line = 0;
+	cache->writes = NULL;
+	cache->nwrites = 0;
+	cache->sorted = true;
 	/* Must be a variable in the struct to allow GCC to unroll. */
 	cache->graphics_ver = GRAPHICS_VER(i915);
 	cache->has_llc = HAS_LLC(i915);
@@ -1114,45 +1203,14 @@ static inline struct i915_ggtt *cache_to_ggtt(struct reloc_cache *cache)
 	return to_gt(i915)->ggtt;
 }
 
-static void reloc_cache_unmap(struct reloc_cache *cache)
+static void reloc_cache_clflush(struct reloc_cache *cache)
 {
-	void *vaddr;
-
-	if (!cache->vaddr)
-		return;
-
-	vaddr = unmask_page(cache->vaddr);
-	if (cache->vaddr & KMAP)
-		kunmap_atomic(vaddr);
-	else
-		io_mapping_unmap_atomic((void __iomem *)vaddr);
-}
-
-static void reloc_cache_remap(struct reloc_cache *cache,
-			      struct drm_i915_gem_object *obj)
-{
-	void *vaddr;
-
-	if (!cache->vaddr)
+	if (!cache->line)
 		return;
 
-	if (cache->vaddr & KMAP) {
-		struct page *page = i915_gem_object_get_page(obj, cache->page);
-
-		vaddr = kmap_atomic(page);
-		cache->vaddr = unmask_flags(cache->vaddr) |
-			(unsigned long)vaddr;
-	} else {
-		struct i915_ggtt *ggtt = cache_to_ggtt(cache);
-		unsigned long offset;
-
-		offset = cache->node.start;
-		if (!drm_mm_node_allocated(&cache->node))
-			offset += cache->page << PAGE_SHIFT;
-
-		cache->vaddr = (unsigned long)
-			io_mapping_map_atomic_wc(&ggtt->iomap, offset);
-	}
+	if (cache->vaddr & CLFLUSH_AFTER)
+		drm_clflush_virt_range((void *)cache->line, L1_CACHE_BYTES);
+	cache->line = 0;
 }
 
 static void reloc_cache_reset(struct reloc_cache *cache, struct i915_execbuffer *eb)
@@ -1162,6 +1220,8 @@ static void reloc_cache_reset(struct reloc_cache *cache, struct i915_execbuffer
 	if (!cache->vaddr)
 		return;
 
+	reloc_cache_clflush(cache);
+
 	vaddr = unmask_page(cache->vaddr);
 	if (cache->vaddr & KMAP) {
 		struct drm_i915_gem_object *obj =
@@ -1329,63 +1389,173 @@ static void *reloc_vaddr(struct i915_vma *vma,
 	return vaddr;
 }
 
-static void clflush_write32(u32 *addr, u32 value, unsigned int flushes)
+static void clflush_write32(struct reloc_cache *cache, u32 *addr, u32 value)
 {
-	if (unlikely(flushes & (CLFLUSH_BEFORE | CLFLUSH_AFTER))) {
-		if (flushes & CLFLUSH_BEFORE)
-			drm_clflush_virt_range(addr, sizeof(*addr));
+	unsigned int flushes = unmask_flags(cache->vaddr);
 
-		*addr = value;
+	if (unlikely(flushes & (CLFLUSH_BEFORE | CLFLUSH_AFTER))) {
+		unsigned long line = round_down((unsigned long)addr,
+						L1_CACHE_BYTES);
 
 		/*
 		 * Writes to the same cacheline are serialised by the CPU
 		 * (including clflush). On the write path, we only require
 		 * that it hits memory in an orderly fashion and place
 		 * mb barriers at the start and end of the relocation phase
-		 * to ensure ordering of clflush wrt to the system.
+		 * to ensure ordering of clflush wrt to the system. As the
+		 * writes arrive sorted, each line is flushed once before its
+		 * first write and once after its last.
 		 */
-		if (flushes & CLFLUSH_AFTER)
-			drm_clflush_virt_range(addr, sizeof(*addr));
-	} else
-		*addr = value;
+		if (line != cache->line) {
+			reloc_cache_clflush(cache);
+			if (flushes & CLFLUSH_BEFORE)
+				drm_clflush_virt_range((void *)line,
+						       L1_CACHE_BYTES);
+			cache->line = line;
+		}
+	}
+
+	*addr = value;
 }
 
-static u64
-relocate_entry(struct i915_vma *vma,
-	       const struct drm_i915_gem_relocation_entry *reloc,
-	       struct i915_execbuffer *eb,
-	       const struct i915_vma *target)
+static int reloc_write32(struct i915_vma *vma,
+			 struct i915_execbuffer *eb,
+			 u64 offset, u32 value)
 {
-	u64 target_addr = relocation_target(reloc, target);
-	u64 offset = reloc->offset;
-	bool wide = eb->reloc_cache.use_64bit_reloc;
+	struct reloc_cache *cache = &eb->reloc_cache;
+	unsigned long page = offset >> PAGE_SHIFT;
 	void *vaddr;
 
-repeat:
-	vaddr = reloc_vaddr(vma, eb,
-			    offset >> PAGE_SHIFT);
+	if (page != cache->page)
+		reloc_cache_clflush(cache);
+
+	vaddr = reloc_vaddr(vma, eb, page);
 	if (IS_ERR(vaddr))
 		return PTR_ERR(vaddr);
 
 	GEM_BUG_ON(!IS_ALIGNED(offset, sizeof(u32)));
-	clflush_write32(vaddr + offset_in_page(offset),
-			lower_32_bits(target_addr),
-			eb->reloc_cache.vaddr);
-
-	if (wide) {
-		offset += sizeof(u32);
-		target_addr >>= 32;
-		wide = false;
-		goto repeat;
+	clflush_write32(cache, vaddr + offset_in_page(offset), value);
+	return 0;
+}
+
+static int reloc_write_cmp(const void *A, const void *B)
+{
+	const struct reloc_write *a = A, *b = B;
+
+	if (a->offset != b->offset)
+		return a->offset < b->offset ? -1 : 1;
+
+	return (int)a->seq - (int)b->seq;
+}
+
+/*
+ * Apply the queued relocations to @vma. Patching in offset order means each
+ * page is only mapped (and the object only prepared for CPU/GTT access) once
+ * per batch, and non-LLC platforms clflush each cacheline once rather than
+ * around every dword.
+ */
+static int reloc_flush(struct i915_execbuffer *eb, struct i915_vma *vma)
+{
+	struct reloc_cache *cache = &eb->reloc_cache;
+	const unsigned int count = cache->nwrites;
+	unsigned int n;
+	int err = 0;
+
+	if (!count)
+		return 0;
+
+	if (!cache->sorted)
+		sort(cache->writes, count, sizeof(*cache->writes),
+		     reloc_write_cmp, NULL);
+
+	for (n = 0; n < count; n++) {
+		const struct reloc_write *w = &cache->writes[n];
+
+		err = reloc_write32(vma, eb, w->offset, lower_32_bits(w->addr));
+		if (!err && cache->use_64bit_reloc)
+			err = reloc_write32(vma, eb, w->offset + sizeof(u32),
+					    upper_32_bits(w->addr));
+		if (err)
+			break;
 	}
+	reloc_cache_reset(cache, eb);
+
+	/*
+	 * Only now that the object has been patched may we update the
+	 * user's relocation entries. Note that reporting an error now
+	 * leaves everything in an inconsistent state as we have *already*
+	 * changed the relocation value inside the object. As we have not
+	 * changed the reloc.presumed_offset or will not change the
+	 * execobject.offset, on the call we may not rewrite the value
+	 * inside the object, leaving it dangling and causing a GPU hang.
+	 * Unless userspace dynamically rebuilds the relocations on each
+	 * execbuf rather than presume a static tree.
+	 *
+	 * We did previously check if the relocations were writable
+	 * (access_ok), an error now would be a strange race with mprotect,
+	 * having already demonstrated that we can read from this userspace
+	 * address.
+	 */
+	if (!err) {
+		pagefault_disable();
+		for (n = 0; n < count; n++) {
+			const struct reloc_write *w = &cache->writes[n];
 
-	return target->node.start | UPDATE;
+			if (w->user)
+				__put_user(gen8_canonical_addr(w->presumed),
+					   w->user);
+		}
+		pagefault_enable();
+	}
+
+	cache->nwrites = 0;
+	cache->sorted = true;
+	return err;
 }
 
-static u64
+static int reloc_queue(struct i915_execbuffer *eb,
+		       struct eb_vma *ev,
+		       const struct drm_i915_gem_relocation_entry *reloc,
+		       const struct i915_vma *target,
+		       u64 __user *user)
+{
+	struct reloc_cache *cache = &eb->reloc_cache;
+	struct reloc_write *w;
+
+	if (unlikely(!cache->writes)) {
+		cache->writes = kvmalloc_array(RELOC_BATCH,
+					       sizeof(*cache->writes),
+					       GFP_KERNEL | __GFP_NOWARN);
+		if (!cache->writes)
+			return -ENOMEM;
+	}
+
+	if (cache->nwrites == RELOC_BATCH) {
+		int err;
+
+		err = reloc_flush(eb, ev->vma);
+		if (err)
+			return err;
+	}
+
+	w = &cache->writes[cache->nwrites];
+	if (cache->nwrites && reloc->offset < w[-1].offset)
+		cache->sorted = false;
+
+	w->offset = reloc->offset;
+	w->addr = relocation_target(reloc, target);
+	w->presumed = target->node.start;
+	w->user = user;
+	w->seq = cache->nwrites++;
+
+	return 0;
+}
+
+static int
 eb_relocate_entry(struct i915_execbuffer *eb,
 		  struct eb_vma *ev,
-		  const struct drm_i915_gem_relocation_entry *reloc)
+		  const struct drm_i915_gem_relocation_entry *reloc,
+		  u64 __user *presumed_offset)
 {
 	struct drm_i915_private *i915 = eb->i915;
 	struct eb_vma *target;
@@ -1433,13 +1603,11 @@ eb_relocate_entry(struct i915_execbuffer *eb,
 		    !i915_vma_is_bound(target->vma, I915_VMA_GLOBAL_BIND)) {
 			struct i915_vma *vma = target->vma;
 
-			reloc_cache_unmap(&eb->reloc_cache);
 			mutex_lock(&vma->vm->mutex);
 			err = i915_vma_bind(target->vma,
 					    target->vma->obj->cache_level,
 					    PIN_GLOBAL, NULL, NULL);
 			mutex_unlock(&vma->vm->mutex);
-			reloc_cache_remap(&eb->reloc_cache, ev->vma->obj);
 			if (err)
 				return err;
 		}
@@ -1481,8 +1649,8 @@ eb_relocate_entry(struct i915_execbuffer *eb,
 	 */
 	ev->flags &= ~EXEC_OBJECT_ASYNC;
 
-	/* and update the user's relocation entry */
-	return relocate_entry(ev->vma, reloc, eb, target->vma);
+	/* and update the user's relocation entry once the write lands */
+	return reloc_queue(eb, ev, reloc, target->vma, presumed_offset);
 }
 
 static int eb_relocate_vma(struct i915_execbuffer *eb, struct eb_vma *ev)
@@ -1529,42 +1697,22 @@ static int eb_relocate_vma(struct i915_execbuffer *eb, struct eb_vma *ev)
 
 		remain -= count;
 		do {
-			u64 offset = eb_relocate_entry(eb, ev, r);
+			int err;
 
-			if (likely(offset == 0)) {
-			} else if ((s64)offset < 0) {
-				remain = (int)offset;
+			err = eb_relocate_entry(eb, ev, r,
+						&urelocs[r - stack].presumed_offset);
+			if (unlikely(err)) {
+				remain = err;
 				goto out;
-			} else {
-				/*
-				 * Note that reporting an error now
-				 * leaves everything in an inconsistent
-				 * state as we have *already* changed
-				 * the relocation value inside the
-				 * object. As we have not changed the
-				 * reloc.presumed_offset or will not
-				 * change the execobject.offset, on the
-				 * call we may not rewrite the value
-				 * inside the object, leaving it
-				 * dangling and causing a GPU hang. Unless
-				 * userspace dynamically rebuilds the
-				 * relocations on each execbuf rather than
-				 * presume a static tree.
-				 *
-				 * We did previously check if the relocations
-				 * were writable (access_ok), an error now
-				 * would be a strange race with mprotect,
-				 * having already demonstrated that we
-				 * can read from this userspace address.
-				 */
-				offset = gen8_canonical_addr(offset & ~UPDATE);
-				__put_user(offset,
-					   &urelocs[r - stack].presumed_offset);
 			}
 		} while (r++, --count);
 		urelocs += ARRAY_SIZE(stack);
 	} while (remain);
+
+	remain = reloc_flush(eb, ev->vma);
 out:
+	eb->reloc_cache.nwrites = 0;
+	eb->reloc_cache.sorted = true;
 	reloc_cache_reset(&eb->reloc_cache, eb);
 	return remain;
 }
@@ -1579,15 +1727,15 @@ eb_relocate_vma_slow(struct i915_execbuffer *eb, struct eb_vma *ev)
 	int err;
 
 	for (i = 0; i < entry->relocation_count; i++) {
-		u64 offset = eb_relocate_entry(eb, ev, &relocs[i]);
-
-		if ((s64)offset < 0) {
-			err = (int)offset;
+		err = eb_relocate_entry(eb, ev, &relocs[i], NULL);
+		if (err)
 			goto err;
-		}
 	}
-	err = 0;
+
+	err = reloc_flush(eb, ev->vma);
 err:
+	eb->reloc_cache.nwrites = 0;
+	eb->reloc_cache.sorted = true;
 	reloc_cache_reset(&eb->reloc_cache, eb);
 	return err;
 }
@@ -715,7 +715,7 @@ insert_mmo(struct drm_i915_gem_object *obj, struct i915_mmap_offset *mmo)
 			spin_unlock(&obj->mmo.lock);
 			drm_vma_offset_remove(obj->base.dev->vma_offset_manager,
 					      &mmo->vma_node);
-			kfree(mmo);
+			kfree_rcu(mmo, rcu);
 			return pos;
 		}
 
@@ -1033,14 +1033,13 @@ int i915_gem_mmap(struct file *filp, struct vm_area_struct *vma)
 		return -ENODEV;
 
 	rcu_read_lock();
-	drm_vma_offset_lock_lookup(dev->vma_offset_manager);
-	node = drm_vma_offset_exact_lookup_locked(dev->vma_offset_manager,
-						  vma->vm_pgoff,
-						  vma_pages(vma));
+	node = drm_vma_offset_exact_lookup_rcu(dev->vma_offset_manager,
+					       vma->vm_pgoff,
+					       vma_pages(vma));
 	if (node && drm_vma_node_is_allowed(node, priv)) {
 		/*
 		 * Skip 0-refcnted objects as it is in the process of being
-		 * destroyed and will be invalid when the vma manager lock
+		 * destroyed and will be invalid when the RCU read lock
 		 * is released.
 		 */
 		if (!node->driver_private) {
@@ -1056,7 +1055,6 @@ int i915_gem_mmap(struct file *filp, struct vm_area_struct *vma)
 			GEM_BUG_ON(obj && !obj->ops->mmap_ops);
 		}
 	}
-	drm_vma_offset_unlock_lookup(dev->vma_offset_manager);
 	rcu_read_unlock();
 	if (!obj)
 		return node ? -EACCES : -EINVAL;
@@ -214,6 +214,8 @@ static void i915_gem_close_object(struct drm_gem_object *gem, struct drm_file *f
 			GEM_BUG_ON(!atomic_read(&vma->open_count));
 			i915_vma_close(vma);
 		}
+		/* The handle may be reused, so retire the execbuf lut cache */
+		WRITE_ONCE(ctx->lut_generation, ctx->lut_generation + 1);
 		mutex_unlock(&ctx->lut_mutex);
 
 		i915_gem_context_put(lut->ctx);
@@ -251,7 +253,7 @@ static void __i915_gem_object_free_mmaps(struct drm_i915_gem_object *obj)
 						     offset) {
 			drm_vma_offset_remove(obj->base.dev->vma_offset_manager,
 					      &mmo->vma_node);
-			kfree(mmo);
+			kfree_rcu(mmo, rcu);
 		}
 		obj->mmo.offsets = RB_ROOT;
 	}
@@ -218,6 +218,7 @@ struct i915_mmap_offset {
 	enum i915_mmap_type mmap_type;
 
 	struct rb_node offset;
+	struct rcu_head rcu;
 };
 
 struct i915_gem_object_page_iter {
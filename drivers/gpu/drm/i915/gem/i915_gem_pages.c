@@ -192,6 +192,13 @@ static void __i915_gem_object_reset_page_iter(struct drm_i915_gem_object *obj)
 
 static void unmap_object(struct drm_i915_gem_object *obj, void *ptr)
 {
+#ifdef __FreeBSD__
+	/* The vmap_pfn() mappings of iomem aren't from the vmalloc arena */
+	if (!i915_gem_object_has_struct_page(obj)) {
+		vunmap(ptr);
+		return;
+	}
+#endif
 	if (is_vmalloc_addr(ptr))
 		vunmap(ptr);
 }
@@ -330,12 +337,6 @@ static void *i915_gem_object_map_page(struct drm_i915_gem_object *obj,
 static void *i915_gem_object_map_pfn(struct drm_i915_gem_object *obj,
 				     enum i915_map_type type)
 {
-#ifdef __FreeBSD__
-	/* BSDFIXME: Need vmap_pfn() implementation. */
-	/* FIXME BSD */
-	UNIMPLEMENTED();
-	return NULL;
-#else	
 	resource_size_t iomap = obj->mm.region->iomap.base -
 		obj->mm.region->region.start;
 	unsigned long n_pfn = obj->base.size >> PAGE_SHIFT;
@@ -361,7 +362,6 @@ static void *i915_gem_object_map_pfn(struct drm_i915_gem_object *obj,
 		kvfree(pfns);
 
 	return vaddr ?: ERR_PTR(-ENOMEM);
-#endif
 }
 
 /* get, pin, and map the pages of the object into kernel space */
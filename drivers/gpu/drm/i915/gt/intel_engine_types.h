@@ -44,11 +44,11 @@
 #define I915_MAX_SLICES	3
 #define I915_MAX_SUBSLICES 8
 
-#define I915_CMD_HASH_ORDER 9
-
 struct dma_fence;
 struct drm_i915_gem_object;
 struct drm_i915_reg_table;
+struct i915_cmd_cache;
+struct i915_cmd_lookup;
 struct i915_gem_context;
 struct i915_request;
 struct i915_sched_attr;
@@ -564,10 +564,10 @@ struct intel_engine_cs {
 	unsigned int flags;
 
 	/*
-	 * Table of commands the command parser needs to know about
-	 * for this engine.
+	 * Flattened tables of the commands and registers the command parser
+	 * needs to know about for this engine.
 	 */
-	DECLARE_HASHTABLE(cmd_hash, I915_CMD_HASH_ORDER);
+	struct i915_cmd_lookup *cmd_lookup;
 
 	/*
 	 * Table of registers allowed in commands that read/write registers.
@@ -575,6 +575,12 @@ struct intel_engine_cs {
 	const struct drm_i915_reg_table *reg_tables;
 	int reg_table_count;
 
+	/*
+	 * Verdicts for recently parsed batches, so that resubmitting an
+	 * identical batch can skip the command parser.
+	 */
+	struct i915_cmd_cache *cmd_cache;
+
 	/*
 	 * Returns the bitmask for the length field of the specified command.
 	 * Return 0 for an unrecognized/invalid command.
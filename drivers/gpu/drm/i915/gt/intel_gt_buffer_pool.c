@@ -10,17 +10,42 @@
 #include "intel_engine_pm.h"
 #include "intel_gt_buffer_pool.h"
 
+#define POOL_KEEP_MIN HZ
+#define POOL_KEEP_MAX (8 * HZ)
+
+/*
+ * Size classes, in pages: 1, 2, 3, 4 and then four steps per power of two
+ * (5, 6, 7, 8, 10, 12, 14, 16, 20, ...). Requests are rounded up to their
+ * class, wasting at most a quarter, so that any idle node in a list can be
+ * reused for any request of that class. Everything beyond the last class
+ * (2MiB) shares the final list and is sized exactly.
+ */
+static unsigned int size_class(size_t sz)
+{
+	unsigned long pages = sz >> PAGE_SHIFT;
+	unsigned int shift;
+
+	if (pages <= 4)
+		return pages - 1;
+
+	shift = fls_long(pages - 1) - 3;
+	return 4 * (shift + 1) + ((pages - 1) >> shift) - 4;
+}
+
+static size_t class_size(unsigned int n)
+{
+	if (n < 4)
+		return (n + 1) << PAGE_SHIFT;
+
+	return (size_t)(n % 4 + 5) << ((n - 4) / 4 + PAGE_SHIFT);
+}
+
 static struct list_head *
 bucket_for_size(struct intel_gt_buffer_pool *pool, size_t sz)
 {
-	int n;
+	unsigned int n;
 
-	/*
-	 * Compute a power-of-two bucket, but throw everything greater than
-	 * 16KiB into the same bucket: i.e. the buckets hold objects of
-	 * (1 page, 2 pages, 4 pages, 8+ pages).
-	 */
-	n = fls(sz >> PAGE_SHIFT) - 1;
+	n = size_class(sz);
 	if (n >= ARRAY_SIZE(pool->cache_list))
 		n = ARRAY_SIZE(pool->cache_list) - 1;
 
@@ -40,7 +65,7 @@ static bool pool_free_older_than(struct intel_gt_buffer_pool *pool, long keep)
 	bool active = false;
 	int n;
 
-	/* Free buffers that have not been used in the past second */
+	/* Free buffers that have not been used within the keep-alive window */
 	for (n = 0; n < ARRAY_SIZE(pool->cache_list); n++) {
 		struct list_head *list = &pool->cache_list[n];
 
@@ -64,6 +89,7 @@ static bool pool_free_older_than(struct intel_gt_buffer_pool *pool, long keep)
 				if (!xchg(&node->age, 0))
 					break;
 
+				pool->cached -= node->obj->base.size;
 				node->free = stale;
 				stale = node;
 			}
@@ -76,6 +102,9 @@ static bool pool_free_older_than(struct intel_gt_buffer_pool *pool, long keep)
 		active |= !list_empty(list);
 	}
 
+	if (stale && keep)
+		WRITE_ONCE(pool->last_reap, jiffies);
+
 	while ((node = stale)) {
 		stale = stale->free;
 		node_free(node);
@@ -89,7 +118,13 @@ static void pool_free_work(struct work_struct *wrk)
 	struct intel_gt_buffer_pool *pool =
 		container_of(wrk, typeof(*pool), work.work);
 
-	if (pool_free_older_than(pool, HZ))
+	/* Once demand has settled, decay back to the shortest window */
+	if (pool->keep > POOL_KEEP_MIN &&
+	    time_after(jiffies, READ_ONCE(pool->last_miss) + POOL_KEEP_MAX))
+		WRITE_ONCE(pool->keep,
+			   max_t(unsigned long, pool->keep / 2, POOL_KEEP_MIN));
+
+	if (pool_free_older_than(pool, READ_ONCE(pool->keep)))
 		schedule_delayed_work(&pool->work,
 				      round_jiffies_up_relative(HZ));
 }
@@ -113,6 +148,7 @@ static void pool_retire(struct i915_active *ref)
 	GEM_BUG_ON(node->age);
 	spin_lock_irqsave(&pool->lock, flags);
 	list_add_rcu(&node->link, list);
+	pool->cached += node->obj->base.size;
 	WRITE_ONCE(node->age, jiffies ?: 1); /* 0 reserved for active nodes */
 	spin_unlock_irqrestore(&pool->lock, flags);
 
@@ -172,9 +208,13 @@ intel_gt_get_buffer_pool(struct intel_gt *gt, size_t size,
 	struct intel_gt_buffer_pool *pool = &gt->buffer_pool;
 	struct intel_gt_buffer_pool_node *node;
 	struct list_head *list;
+	unsigned int n;
 	int ret;
 
 	size = PAGE_ALIGN(size);
+	n = size_class(size);
+	if (n < ARRAY_SIZE(pool->cache_list))
+		size = class_size(n);
 	list = bucket_for_size(pool, size);
 
 	rcu_read_lock();
@@ -194,6 +234,7 @@ intel_gt_get_buffer_pool(struct intel_gt *gt, size_t size,
 		if (cmpxchg(&node->age, age, 0) == age) {
 			spin_lock_irq(&pool->lock);
 			list_del_rcu(&node->link);
+			pool->cached -= node->obj->base.size;
 			spin_unlock_irq(&pool->lock);
 			break;
 		}
@@ -201,9 +242,24 @@ intel_gt_get_buffer_pool(struct intel_gt *gt, size_t size,
 	rcu_read_unlock();
 
 	if (&node->link == list) {
+		unsigned long keep = READ_ONCE(pool->keep);
+
+		/*
+		 * Missing soon after the worker reaped idle nodes means we
+		 * are freeing buffers a burst is about to ask for again, so
+		 * hold on to them for longer.
+		 */
+		if (time_before(jiffies, READ_ONCE(pool->last_reap) + keep))
+			WRITE_ONCE(pool->keep,
+				   min_t(unsigned long, 2 * keep, POOL_KEEP_MAX));
+		WRITE_ONCE(pool->last_miss, jiffies);
+		atomic_long_inc(&pool->misses);
+
 		node = node_create(pool, size, type);
 		if (IS_ERR(node))
 			return node;
+	} else {
+		atomic_long_inc(&pool->hits);
 	}
 
 	ret = i915_active_acquire(&node->active);
@@ -224,6 +280,13 @@ void intel_gt_init_buffer_pool(struct intel_gt *gt)
 	for (n = 0; n < ARRAY_SIZE(pool->cache_list); n++)
 		INIT_LIST_HEAD(&pool->cache_list[n]);
 	INIT_DELAYED_WORK(&pool->work, pool_free_work);
+
+	pool->keep = POOL_KEEP_MIN;
+	pool->last_reap = jiffies - POOL_KEEP_MAX;
+	pool->last_miss = jiffies;
+	pool->cached = 0;
+	atomic_long_set(&pool->hits, 0);
+	atomic_long_set(&pool->misses, 0);
 }
 
 void intel_gt_flush_buffer_pool(struct intel_gt *gt)
@@ -244,3 +307,18 @@ void intel_gt_fini_buffer_pool(struct intel_gt *gt)
 	for (n = 0; n < ARRAY_SIZE(pool->cache_list); n++)
 		GEM_BUG_ON(!list_empty(&pool->cache_list[n]));
 }
+
+void intel_gt_buffer_pool_print(struct intel_gt_buffer_pool *pool,
+				struct drm_printer *p)
+{
+	unsigned long hits = atomic_long_read(&pool->hits);
+	unsigned long misses = atomic_long_read(&pool->misses);
+
+	drm_printf(p, "Hits: %lu\n", hits);
+	drm_printf(p, "Misses: %lu\n", misses);
+	drm_printf(p, "Hit rate: %lu%%\n",
+		   hits + misses ? hits * 100 / (hits + misses) : 0);
+	drm_printf(p, "Cached: %zu bytes\n", READ_ONCE(pool->cached));
+	drm_printf(p, "Keep-alive: %u ms\n",
+		   jiffies_to_msecs(READ_ONCE(pool->keep)));
+}
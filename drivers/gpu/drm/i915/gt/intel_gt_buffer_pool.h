@@ -11,6 +11,7 @@
 #include "i915_active.h"
 #include "intel_gt_buffer_pool_types.h"
 
+struct drm_printer;
 struct intel_gt;
 struct i915_request;
 
@@ -40,4 +41,7 @@ void intel_gt_init_buffer_pool(struct intel_gt *gt);
 void intel_gt_flush_buffer_pool(struct intel_gt *gt);
 void intel_gt_fini_buffer_pool(struct intel_gt *gt);
 
+void intel_gt_buffer_pool_print(struct intel_gt_buffer_pool *pool,
+				struct drm_printer *p);
+
 #endif /* INTEL_GT_BUFFER_POOL_H */
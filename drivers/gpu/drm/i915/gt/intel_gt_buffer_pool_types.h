@@ -6,6 +6,7 @@
 #ifndef INTEL_GT_BUFFER_POOL_TYPES_H
 #define INTEL_GT_BUFFER_POOL_TYPES_H
 
+#include <linux/atomic.h>
 #include <linux/list.h>
 #include <linux/spinlock.h>
 #include <linux/workqueue.h>
@@ -15,8 +16,19 @@
 
 struct intel_gt_buffer_pool {
 	spinlock_t lock;
-	struct list_head cache_list[4];
+	struct list_head cache_list[32];
 	struct delayed_work work;
+
+	/* How long an idle node is kept, adapted to recent demand */
+	unsigned long keep;
+	unsigned long last_reap;
+	unsigned long last_miss;
+
+	/* Bytes held by idle nodes, protected by @lock */
+	size_t cached;
+
+	atomic_long_t hits;
+	atomic_long_t misses;
 };
 
 struct intel_gt_buffer_pool_node {
@@ -1043,6 +1043,22 @@ void intel_rps_boost(struct i915_request *rq)
 	}
 }
 
+/*
+ * The longest up evaluation interval rps_set_power() programs. A deadline
+ * closer than that may well pass before the autotuning notices the load and
+ * raises the frequency on its own.
+ */
+#define RPS_DEADLINE_BOOST_NS (16 * NSEC_PER_MSEC)
+
+void intel_rps_boost_deadline(struct i915_request *rq, ktime_t deadline)
+{
+	if (ktime_to_ns(ktime_sub(deadline, ktime_get())) >
+	    RPS_DEADLINE_BOOST_NS)
+		return;
+
+	intel_rps_boost(rq);
+}
+
 int intel_rps_set(struct intel_rps *rps, u8 val)
 {
 	int err;
@@ -25,7 +25,11 @@
  *
  */
 
+#include <linux/hash.h>
 #include <linux/highmem.h>
+#include <linux/jhash.h>
+#include <linux/log2.h>
+#include <linux/sort.h>
 
 #include <drm/drm_cache.h>
 
@@ -875,9 +879,32 @@ static bool validate_regs_sorted(struct intel_engine_cs *engine)
 	return true;
 }
 
-struct cmd_node {
+/*
+ * The command and register tables are flattened at init into a per-engine
+ * lookup: an open-addressed array of command slots, sized to stay at most
+ * half full so that probe chains are short and a few slots share each
+ * cacheline, and a single sorted array of register offsets merged from
+ * all of the engine's register tables.
+ */
+struct cmd_slot {
+	u32 value;
+	u32 mask;
 	const struct drm_i915_cmd_descriptor *desc;
-	struct hlist_node node;
+};
+
+struct reg_slot {
+	u32 addr;
+	unsigned int order; /* table order, to keep the first duplicate */
+	const struct drm_i915_reg_descriptor *desc;
+};
+
+struct i915_cmd_lookup {
+	struct cmd_slot *cmds;
+	unsigned int cmd_bits;
+
+	u32 *reg_addr;
+	const struct drm_i915_reg_descriptor **regs;
+	unsigned int num_regs;
 };
 
 /*
@@ -903,45 +930,272 @@ static inline u32 cmd_header_key(u32 x)
 	}
 }
 
-static int init_hash_table(struct intel_engine_cs *engine,
+static void add_cmd(struct i915_cmd_lookup *lookup,
+		    const struct drm_i915_cmd_descriptor *desc)
+{
+	const unsigned int mask = BIT(lookup->cmd_bits) - 1;
+	unsigned int i = hash_32(cmd_header_key(desc->cmd.value),
+				 lookup->cmd_bits);
+
+	while (lookup->cmds[i].desc)
+		i = (i + 1) & mask;
+
+	lookup->cmds[i].value = desc->cmd.value;
+	lookup->cmds[i].mask = desc->cmd.mask;
+	lookup->cmds[i].desc = desc;
+}
+
+static int init_cmd_lookup(struct i915_cmd_lookup *lookup,
 			   const struct drm_i915_cmd_table *cmd_tables,
 			   int cmd_table_count)
 {
+	unsigned int count = 0;
 	int i, j;
 
-	hash_init(engine->cmd_hash);
+	for (i = 0; i < cmd_table_count; i++)
+		count += cmd_tables[i].count;
 
-	for (i = 0; i < cmd_table_count; i++) {
+	lookup->cmd_bits = max_t(unsigned int, order_base_2(2 * count), 1);
+	lookup->cmds = kcalloc(BIT(lookup->cmd_bits), sizeof(*lookup->cmds),
+			       GFP_KERNEL);
+	if (!lookup->cmds)
+		return -ENOMEM;
+
+	/*
+	 * Probing returns the first match along the chain, so insert in
+	 * reverse to let the later, engine specific, tables take precedence
+	 * over the common commands.
+	 */
+	for (i = cmd_table_count - 1; i >= 0; i--) {
 		const struct drm_i915_cmd_table *table = &cmd_tables[i];
 
-		for (j = 0; j < table->count; j++) {
-			const struct drm_i915_cmd_descriptor *desc =
-				&table->table[j];
-			struct cmd_node *desc_node =
-				kmalloc(sizeof(*desc_node), GFP_KERNEL);
+		for (j = table->count - 1; j >= 0; j--)
+			add_cmd(lookup, &table->table[j]);
+	}
+
+	return 0;
+}
+
+static int reg_slot_cmp(const void *A, const void *B)
+{
+	const struct reg_slot *a = A, *b = B;
+
+	if (a->addr != b->addr)
+		return a->addr < b->addr ? -1 : 1;
 
-			if (!desc_node)
-				return -ENOMEM;
+	return (int)a->order - (int)b->order;
+}
+
+static int init_reg_lookup(struct i915_cmd_lookup *lookup,
+			   const struct drm_i915_reg_table *reg_tables,
+			   int reg_table_count)
+{
+	struct reg_slot *slots;
+	unsigned int count = 0, n = 0;
+	int i, j;
 
-			desc_node->desc = desc;
-			hash_add(engine->cmd_hash, &desc_node->node,
-				 cmd_header_key(desc->cmd.value));
+	for (i = 0; i < reg_table_count; i++)
+		count += reg_tables[i].num_regs;
+	if (!count)
+		return 0;
+
+	slots = kmalloc_array(count, sizeof(*slots), GFP_KERNEL);
+	if (!slots)
+		return -ENOMEM;
+
+	for (i = 0; i < reg_table_count; i++) {
+		const struct drm_i915_reg_table *table = &reg_tables[i];
+
+		for (j = 0; j < table->num_regs; j++) {
+			slots[n].addr = i915_mmio_reg_offset(table->regs[j].addr);
+			slots[n].order = n;
+			slots[n].desc = &table->regs[j];
+			n++;
 		}
 	}
+	sort(slots, count, sizeof(*slots), reg_slot_cmp, NULL);
+
+	lookup->reg_addr = kmalloc_array(count, sizeof(*lookup->reg_addr),
+					 GFP_KERNEL);
+	lookup->regs = kmalloc_array(count, sizeof(*lookup->regs), GFP_KERNEL);
+	if (!lookup->reg_addr || !lookup->regs) {
+		kfree(slots);
+		return -ENOMEM;
+	}
+
+	/* As with find_reg() over the tables, the first table wins */
+	for (i = 0, n = 0; i < count; i++) {
+		if (n && lookup->reg_addr[n - 1] == slots[i].addr)
+			continue;
+
+		lookup->reg_addr[n] = slots[i].addr;
+		lookup->regs[n] = slots[i].desc;
+		n++;
+	}
+	lookup->num_regs = n;
 
+	kfree(slots);
 	return 0;
 }
 
-static void fini_hash_table(struct intel_engine_cs *engine)
+static void fini_lookup(struct intel_engine_cs *engine)
 {
-	struct hlist_node *tmp;
-	struct cmd_node *desc_node;
-	int i;
+	struct i915_cmd_lookup *lookup = fetch_and_zero(&engine->cmd_lookup);
+
+	if (!lookup)
+		return;
+
+	kfree(lookup->regs);
+	kfree(lookup->reg_addr);
+	kfree(lookup->cmds);
+	kfree(lookup);
+}
+
+static int init_lookup(struct intel_engine_cs *engine,
+		       const struct drm_i915_cmd_table *cmd_tables,
+		       int cmd_table_count)
+{
+	struct i915_cmd_lookup *lookup;
+	int err;
+
+	lookup = kzalloc(sizeof(*lookup), GFP_KERNEL);
+	if (!lookup)
+		return -ENOMEM;
+
+	engine->cmd_lookup = lookup;
+
+	err = init_cmd_lookup(lookup, cmd_tables, cmd_table_count);
+	if (err)
+		return err;
+
+	return init_reg_lookup(lookup,
+			       engine->reg_tables, engine->reg_table_count);
+}
+
+/*
+ * A small direct-mapped cache of batches that passed the parser, keyed by a
+ * hash of their contents. A hit is only taken once the freshly copied shadow
+ * compares equal to the remembered contents: the user can rewrite the batch
+ * through a mmap at any point without us noticing, so neither the hash nor
+ * the object's domain tracking can be trusted to prove the batch unchanged.
+ */
+#define CMD_CACHE_SLOTS 8
+#define CMD_CACHE_MAX_LENGTH SZ_32K
+#define CMD_CACHE_NO_BBSTART U32_MAX
+
+struct cmd_cache_entry {
+	struct kref ref;
+	u64 batch_addr;
+	u32 hash;
+	u32 length;
+	u32 bbstart; /* dword offset of the terminating BB_START */
+	u32 jump; /* byte offset of the BB_START target in the batch */
+	bool trampoline;
+	u32 cmds[]; /* batch as submitted by the user */
+};
+
+struct i915_cmd_cache {
+	spinlock_t lock;
+	struct cmd_cache_entry *slot[CMD_CACHE_SLOTS];
+};
+
+static void cmd_cache_entry_release(struct kref *ref)
+{
+	kfree(container_of(ref, struct cmd_cache_entry, ref));
+}
+
+static void cmd_cache_entry_put(struct cmd_cache_entry *entry)
+{
+	kref_put(&entry->ref, cmd_cache_entry_release);
+}
+
+static struct cmd_cache_entry *
+cmd_cache_lookup(struct i915_cmd_cache *cache, const u32 *cmds, u32 hash,
+		 u32 length, u64 batch_addr, bool trampoline)
+{
+	struct cmd_cache_entry *entry;
+
+	spin_lock(&cache->lock);
+	entry = cache->slot[hash % CMD_CACHE_SLOTS];
+	if (entry &&
+	    (entry->hash != hash ||
+	     entry->length != length ||
+	     entry->batch_addr != batch_addr ||
+	     entry->trampoline != trampoline))
+		entry = NULL;
+	if (entry)
+		kref_get(&entry->ref);
+	spin_unlock(&cache->lock);
+	if (!entry)
+		return NULL;
+
+	if (memcmp(entry->cmds, cmds, length)) {
+		cmd_cache_entry_put(entry);
+		return NULL;
+	}
+
+	return entry;
+}
+
+static void cmd_cache_insert(struct i915_cmd_cache *cache, const u32 *cmds,
+			     u32 hash, u32 length, u64 batch_addr,
+			     u64 shadow_addr, u32 bbstart, bool trampoline)
+{
+	struct cmd_cache_entry *entry, *old;
+
+	entry = kmalloc(struct_size(entry, cmds, length / sizeof(u32)),
+			GFP_KERNEL | __GFP_NOWARN);
+	if (!entry)
+		return;
 
-	hash_for_each_safe(engine->cmd_hash, i, tmp, desc_node, node) {
-		hash_del(&desc_node->node);
-		kfree(desc_node);
+	kref_init(&entry->ref);
+	entry->batch_addr = batch_addr;
+	entry->hash = hash;
+	entry->length = length;
+	entry->bbstart = bbstart;
+	entry->trampoline = trampoline;
+	memcpy(entry->cmds, cmds, length);
+
+	/* Undo the relocation of the jump into the shadow by check_bbstart() */
+	if (bbstart != CMD_CACHE_NO_BBSTART) {
+		entry->jump = *(u64 *)(cmds + bbstart + 1) - shadow_addr;
+		*(u64 *)(entry->cmds + bbstart + 1) = batch_addr + entry->jump;
 	}
+
+	spin_lock(&cache->lock);
+	old = cache->slot[hash % CMD_CACHE_SLOTS];
+	cache->slot[hash % CMD_CACHE_SLOTS] = entry;
+	spin_unlock(&cache->lock);
+
+	if (old)
+		cmd_cache_entry_put(old);
+}
+
+static void init_cmd_cache(struct intel_engine_cs *engine)
+{
+	struct i915_cmd_cache *cache;
+
+	/* The cache is only an optimisation, so parse every batch without */
+	cache = kzalloc(sizeof(*cache), GFP_KERNEL);
+	if (!cache)
+		return;
+
+	spin_lock_init(&cache->lock);
+	engine->cmd_cache = cache;
+}
+
+static void fini_cmd_cache(struct intel_engine_cs *engine)
+{
+	struct i915_cmd_cache *cache = fetch_and_zero(&engine->cmd_cache);
+	int i;
+
+	if (!cache)
+		return;
+
+	for (i = 0; i < ARRAY_SIZE(cache->slot); i++)
+		if (cache->slot[i])
+			cmd_cache_entry_put(cache->slot[i]);
+	kfree(cache);
 }
 
 /**
@@ -1040,14 +1294,16 @@ int intel_engine_init_cmd_parser(struct intel_engine_cs *engine)
 		goto out;
 	}
 
-	ret = init_hash_table(engine, cmd_tables, cmd_table_count);
+	ret = init_lookup(engine, cmd_tables, cmd_table_count);
 	if (ret) {
 		drm_err(&engine->i915->drm,
 			"%s: initialised failed!\n", engine->name);
-		fini_hash_table(engine);
+		fini_lookup(engine);
 		goto out;
 	}
 
+	init_cmd_cache(engine);
+
 	engine->flags |= I915_ENGINE_USING_CMD_PARSER;
 
 out:
@@ -1070,20 +1326,23 @@ void intel_engine_cleanup_cmd_parser(struct intel_engine_cs *engine)
 	if (!intel_engine_using_cmd_parser(engine))
 		return;
 
-	fini_hash_table(engine);
+	fini_cmd_cache(engine);
+	fini_lookup(engine);
 }
 
 static const struct drm_i915_cmd_descriptor*
 find_cmd_in_table(struct intel_engine_cs *engine,
 		  u32 cmd_header)
 {
-	struct cmd_node *desc_node;
-
-	hash_for_each_possible(engine->cmd_hash, desc_node, node,
-			       cmd_header_key(cmd_header)) {
-		const struct drm_i915_cmd_descriptor *desc = desc_node->desc;
-		if (((cmd_header ^ desc->cmd.value) & desc->cmd.mask) == 0)
-			return desc;
+	const struct i915_cmd_lookup *lookup = engine->cmd_lookup;
+	const unsigned int mask = BIT(lookup->cmd_bits) - 1;
+	unsigned int i = hash_32(cmd_header_key(cmd_header), lookup->cmd_bits);
+	const struct cmd_slot *slot;
+
+	for (slot = &lookup->cmds[i]; slot->desc;
+	     slot = &lookup->cmds[i = (i + 1) & mask]) {
+		if (((cmd_header ^ slot->value) & slot->mask) == 0)
+			return slot->desc;
 	}
 
 	return NULL;
@@ -1124,33 +1383,23 @@ find_cmd(struct intel_engine_cs *engine,
 }
 
 static const struct drm_i915_reg_descriptor *
-__find_reg(const struct drm_i915_reg_descriptor *table, int count, u32 addr)
+find_reg(const struct intel_engine_cs *engine, u32 addr)
 {
-	int start = 0, end = count;
+	const struct i915_cmd_lookup *lookup = engine->cmd_lookup;
+	unsigned int start = 0, end = lookup->num_regs;
+
 	while (start < end) {
-		int mid = start + (end - start) / 2;
-		int ret = addr - i915_mmio_reg_offset(table[mid].addr);
-		if (ret < 0)
+		unsigned int mid = start + (end - start) / 2;
+
+		if (addr < lookup->reg_addr[mid])
 			end = mid;
-		else if (ret > 0)
+		else if (addr > lookup->reg_addr[mid])
 			start = mid + 1;
 		else
-			return &table[mid];
+			return lookup->regs[mid];
 	}
-	return NULL;
-}
-
-static const struct drm_i915_reg_descriptor *
-find_reg(const struct intel_engine_cs *engine, u32 addr)
-{
-	const struct drm_i915_reg_table *table = engine->reg_tables;
-	const struct drm_i915_reg_descriptor *reg = NULL;
-	int count = engine->reg_table_count;
-
-	for (; !reg && (count > 0); ++table, --count)
-		reg = __find_reg(table->regs, table->num_regs, addr);
 
-	return reg;
+	return NULL;
 }
 
 /* Returns a vmap'd pointer to dst_obj, which the caller must unmap */
@@ -1431,7 +1680,8 @@ static unsigned long *alloc_whitelist(u32 batch_length)
  * @trampoline: true if we need to trampoline into privileged execution
  *
  * Parses the specified batch buffer looking for privilege violations as
- * described in the overview.
+ * described in the overview. Batches identical to one recently found to be
+ * safe on this engine are copied but not parsed again.
  *
  * Return: non-zero if the parser finds violations or otherwise fails; -EACCES
  * if the batch appears legal but should use hardware parsing
@@ -1447,7 +1697,10 @@ int intel_engine_cmd_parser(struct intel_engine_cs *engine,
 	u32 *cmd, *batch_end, offset = 0;
 	struct drm_i915_cmd_descriptor default_desc = noop_desc;
 	const struct drm_i915_cmd_descriptor *desc = &default_desc;
+	struct i915_cmd_cache *cache = engine->cmd_cache;
+	u32 hash = 0, bbstart = CMD_CACHE_NO_BBSTART;
 	bool needs_clflush_after = false;
+	struct cmd_cache_entry *cached;
 	unsigned long *jump_whitelist;
 	u64 batch_addr, shadow_addr;
 	int ret = 0;
@@ -1466,11 +1719,6 @@ int intel_engine_cmd_parser(struct intel_engine_cs *engine,
 		return PTR_ERR(cmd);
 	}
 
-	jump_whitelist = NULL;
-	if (!trampoline)
-		/* Defer failure until attempted use */
-		jump_whitelist = alloc_whitelist(batch_length);
-
 	shadow_addr = gen8_canonical_addr(shadow->node.start);
 	batch_addr = gen8_canonical_addr(batch->node.start + batch_offset);
 
@@ -1480,6 +1728,29 @@ int intel_engine_cmd_parser(struct intel_engine_cs *engine,
 	 * space. Parsing should be faster in some cases this way.
 	 */
 	batch_end = cmd + batch_length / sizeof(*batch_end);
+
+	if (cache && batch_length > CMD_CACHE_MAX_LENGTH)
+		cache = NULL;
+
+	cached = NULL;
+	if (cache) {
+		hash = jhash2(cmd, batch_length / sizeof(*cmd), 0);
+		cached = cmd_cache_lookup(cache, cmd, hash, batch_length,
+					  batch_addr, trampoline);
+	}
+	if (cached) {
+		if (cached->bbstart != CMD_CACHE_NO_BBSTART)
+			*(u64 *)(cmd + cached->bbstart + 1) =
+				shadow_addr + cached->jump;
+		cmd_cache_entry_put(cached);
+		goto parsed;
+	}
+
+	jump_whitelist = NULL;
+	if (!trampoline)
+		/* Defer failure until attempted use */
+		jump_whitelist = alloc_whitelist(batch_length);
+
 	do {
 		u32 length;
 
@@ -1516,6 +1787,7 @@ int intel_engine_cmd_parser(struct intel_engine_cs *engine,
 			ret = check_bbstart(cmd, offset, length, batch_length,
 					    batch_addr, shadow_addr,
 					    jump_whitelist);
+			bbstart = offset;
 			break;
 		}
 
@@ -1531,6 +1803,15 @@ int intel_engine_cmd_parser(struct intel_engine_cs *engine,
 		}
 	} while (1);
 
+	if (!IS_ERR_OR_NULL(jump_whitelist))
+		kfree(jump_whitelist);
+
+	if (cache && !ret)
+		cmd_cache_insert(cache, page_mask_bits(shadow->obj->mm.mapping),
+				 hash, batch_length, batch_addr, shadow_addr,
+				 bbstart, trampoline);
+
+parsed:
 	if (trampoline) {
 		/*
 		 * With the trampoline, the shadow is executed twice.
@@ -1570,9 +1851,6 @@ int intel_engine_cmd_parser(struct intel_engine_cs *engine,
 	}
 
 	i915_gem_object_flush_map(shadow->obj);
-
-	if (!IS_ERR_OR_NULL(jump_whitelist))
-		kfree(jump_whitelist);
 	i915_gem_object_unpin_map(shadow->obj);
 	return ret;
 }
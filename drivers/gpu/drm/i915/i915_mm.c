@@ -31,8 +31,6 @@
 
 #ifdef __FreeBSD__
 #include <vm/vm_pageout.h>
-#define	pte_t	linux_pte_t
-#define	apply_to_page_range(dummy, ...)	remap_page_range(__VA_ARGS__)
 #define	flush_cache_range(...)
 #endif
 
@@ -58,6 +56,7 @@ static inline unsigned long sgt_pfn(const struct remap_pfn *r)
 		return r->sgt.pfn + (r->sgt.curr >> PAGE_SHIFT);
 }
 
+#ifdef __linux__
 static int remap_sg(pte_t *pte, unsigned long addr, void *data)
 {
 	struct remap_pfn *r = data;
@@ -65,18 +64,9 @@ static int remap_sg(pte_t *pte, unsigned long addr, void *data)
 	if (GEM_WARN_ON(!r->sgt.sgp))
 		return -EINVAL;
 
-#ifdef __linux__
 	/* Special PTE are not associated with any struct page */
 	set_pte_at(r->mm, addr, pte,
 		   pte_mkspecial(pfn_pte(sgt_pfn(r), r->prot)));
-#elif defined(__FreeBSD__)
-	vm_fault_t ret =
-	    lkpi_vmf_insert_pfn_prot_locked(r->vma, addr, sgt_pfn(r), r->prot);
-	if ((ret & VM_FAULT_OOM) != 0)
-		return -ENOMEM;
-	if ((ret & VM_FAULT_ERROR) != 0)
-		return -EFAULT;
-#endif
 	r->pfn++; /* track insertions in case we need to unwind later */
 
 	r->sgt.curr += PAGE_SIZE;
@@ -85,30 +75,71 @@ static int remap_sg(pte_t *pte, unsigned long addr, void *data)
 
 	return 0;
 }
+#elif defined(__FreeBSD__)
+/*
+ * Insert a physically contiguous run of pfns, waiting for memory if the pager
+ * runs out of it. With large set the 2M aligned parts of the run may be
+ * mapped with superpages, so only use it for device memory.
+ */
+static int
+remap_pfn_run(struct remap_pfn *r, unsigned long addr, unsigned long pfn,
+    unsigned long count, bool large)
+{
+	vm_object_t vm_obj = r->vma->vm_obj;
+	unsigned long nr;
+	vm_fault_t ret;
 
-#define EXPECTED_FLAGS (VM_PFNMAP | VM_DONTEXPAND | VM_DONTDUMP)
+	VM_OBJECT_ASSERT_WLOCKED(vm_obj);
+
+	while (count != 0) {
+		nr = count;
+		ret = lkpi_vmf_insert_pfn_range_prot_locked(r->vma, addr, pfn,
+		    &nr, r->prot, large);
+		if ((ret & VM_FAULT_OOM) != 0) {
+			VM_OBJECT_WUNLOCK(vm_obj);
+			vm_wait(NULL);
+			VM_OBJECT_WLOCK(vm_obj);
+			continue;
+		}
+		if ((ret & VM_FAULT_ERROR) != 0 || nr == 0)
+			return (-EFAULT);
+
+		r->pfn += nr; /* track insertions in case we need to unwind */
+		addr += ptoa(nr);
+		pfn += nr;
+		count -= nr;
+	}
+
+	return (0);
+}
 
-#ifdef __FreeBSD__
 static int
-remap_page_range(unsigned long start_addr, unsigned long size,
-    pte_fn_t fn,  struct remap_pfn *r)
+remap_sg_range(unsigned long addr, unsigned long size, struct remap_pfn *r)
 {
 	vm_object_t vm_obj = r->vma->vm_obj;
-	unsigned long addr;
+	unsigned long count;
 	int err = 0;
 
 	VM_OBJECT_WLOCK(vm_obj);
-	for (addr = start_addr; addr < start_addr + size; addr += PAGE_SIZE) {
-retry:
-		err = fn(0, addr, r);
-		if (err == -ENOMEM) {
-			VM_OBJECT_WUNLOCK(vm_obj);
-			vm_wait(NULL);
-			VM_OBJECT_WLOCK(vm_obj);
-			goto retry;
+	while (size != 0) {
+		if (GEM_WARN_ON(!r->sgt.sgp)) {
+			err = -EINVAL;
+			break;
 		}
+
+		count = min(size, (unsigned long)(r->sgt.max - r->sgt.curr)) >>
+		    PAGE_SHIFT;
+		err = remap_pfn_run(r, addr, sgt_pfn(r), count,
+		    use_dma(r->iobase));
 		if (err != 0)
 			break;
+
+		addr += ptoa(count);
+		size -= ptoa(count);
+		r->sgt.curr += ptoa(count);
+		if (r->sgt.curr >= r->sgt.max)
+			r->sgt = __sgt_iter(__sg_next(r->sgt.sgp),
+			    use_dma(r->iobase));
 	}
 	VM_OBJECT_WUNLOCK(vm_obj);
 
@@ -116,27 +147,21 @@ retry:
 }
 #endif
 
+#define EXPECTED_FLAGS (VM_PFNMAP | VM_DONTEXPAND | VM_DONTDUMP)
+
 #if IS_ENABLED(CONFIG_X86)
+#ifdef __linux__
 static int remap_pfn(pte_t *pte, unsigned long addr, void *data)
 {
 	struct remap_pfn *r = data;
 
 	/* Special PTE are not associated with any struct page */
-#ifdef __linux__
-	/* Special PTE are not associated with any struct page */
 	set_pte_at(r->mm, addr, pte, pte_mkspecial(pfn_pte(r->pfn, r->prot)));
-#elif defined(__FreeBSD__)
-	vm_fault_t ret;
-	ret = lkpi_vmf_insert_pfn_prot_locked(r->vma, addr, r->pfn, r->prot);
-	if ((ret & VM_FAULT_OOM) != 0)
-		return -ENOMEM;
-	if ((ret & VM_FAULT_ERROR) != 0)
-		return -EFAULT;
-#endif
 	r->pfn++;
 
 	return 0;
 }
+#endif
 
 /**
  * remap_io_mapping - remap an IO mapping to userspace
@@ -168,7 +193,13 @@ int remap_io_mapping(struct vm_area_struct *vma,
 	r.prot = cachemode2protval(iomap->attr);
 #endif
 
+#ifdef __linux__
 	err = apply_to_page_range(r.mm, addr, size, remap_pfn, &r);
+#elif defined(__FreeBSD__)
+	VM_OBJECT_WLOCK(vma->vm_obj);
+	err = remap_pfn_run(&r, addr, pfn, size >> PAGE_SHIFT, true);
+	VM_OBJECT_WUNLOCK(vma->vm_obj);
+#endif
 	if (unlikely(err)) {
 		zap_vma_ptes(vma, addr, (r.pfn - pfn) << PAGE_SHIFT);
 		return err;
@@ -209,7 +240,11 @@ int remap_io_sg(struct vm_area_struct *vma,
 	if (!use_dma(iobase))
 		flush_cache_range(vma, addr, size);
 
+#ifdef __linux__
 	err = apply_to_page_range(r.mm, addr, size, remap_sg, &r);
+#elif defined(__FreeBSD__)
+	err = remap_sg_range(addr, size, &r);
+#endif
 	if (unlikely(err)) {
 		zap_vma_ptes(vma, addr, r.pfn << PAGE_SHIFT);
 		return err;
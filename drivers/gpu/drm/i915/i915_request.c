@@ -107,6 +107,36 @@ static signed long i915_fence_wait(struct dma_fence *fence,
 					 timeout);
 }
 
+static void i915_fence_set_deadline(struct dma_fence *fence,
+				    ktime_t deadline)
+{
+	struct i915_request *rq = to_request(fence);
+	const struct i915_sched_attr attr = {
+		.priority = I915_PRIORITY_DISPLAY,
+	};
+	struct intel_engine_cs *engine;
+
+	if (i915_request_completed(rq))
+		return;
+
+	/*
+	 * Someone, most likely a compositor, needs this request by the
+	 * deadline. Treat it like the fence of a pending pageflip: bump it
+	 * and its dependencies to display priority, and if the deadline is
+	 * too close to wait for RPS to react, boost the clocks as a waiter
+	 * would.
+	 */
+	local_bh_disable();
+	rcu_read_lock(); /* RCU serialisation for set-wedged protection */
+	engine = READ_ONCE(rq->engine);
+	if (engine->sched_engine->schedule)
+		engine->sched_engine->schedule(rq, &attr);
+	rcu_read_unlock();
+	local_bh_enable(); /* kick the tasklets if queues were reprioritised */
+
+	intel_rps_boost_deadline(rq, deadline);
+}
+
 struct kmem_cache *i915_request_slab_cache(void)
 {
 	return slab_requests;
@@ -183,6 +213,7 @@ const struct dma_fence_ops i915_fence_ops = {
 	.signaled = i915_fence_signaled,
 	.wait = i915_fence_wait,
 	.release = i915_fence_release,
+	.set_deadline = i915_fence_set_deadline,
 };
 
 static void irq_execute_cb(struct irq_work *wrk)
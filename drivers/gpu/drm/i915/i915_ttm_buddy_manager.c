@@ -321,6 +321,9 @@ int i915_ttm_buddy_man_init(struct ttm_device *bdev,
 	if (err)
 		goto err_free_bman;
 
+	/* Most allocations are for the minimum page size, keep some around */
+	drm_buddy_cache_enable(&bman->mm, 512);
+
 	mutex_init(&bman->lock);
 	INIT_LIST_HEAD(&bman->reserved);
 	GEM_BUG_ON(default_page_size < chunk_size);
@@ -810,6 +810,73 @@ out_put:
 	return err;
 }
 
+static int igt_lmem_map_pfn(void *arg)
+{
+	static const u64 sizes[] = { SZ_2M, SZ_64M, SZ_512M };
+	struct drm_i915_private *i915 = arg;
+	struct intel_memory_region *mr;
+	struct drm_i915_gem_object *obj;
+	unsigned int i;
+	int err = 0;
+
+	mr = i915->mm.regions[INTEL_REGION_LMEM_0];
+	if (!mr)
+		return 0;
+
+	for (i = 0; i < ARRAY_SIZE(sizes); i++) {
+		const unsigned long passes = 64;
+		unsigned long pass;
+		ktime_t t0, t1;
+		void *vaddr;
+		u64 ns;
+
+		/* Only the CPU visible part of LMEM can be mapped */
+		if (sizes[i] > mr->io_size)
+			break;
+
+		obj = i915_gem_object_create_lmem(i915, sizes[i], 0);
+		if (IS_ERR(obj)) {
+			err = PTR_ERR(obj);
+			if (err == -ENOMEM || err == -ENXIO)
+				err = 0;
+			break;
+		}
+
+		/* LMEM has no struct page, pin_map() goes through vmap_pfn() */
+		i915_gem_object_lock(obj, NULL);
+		t0 = ktime_get();
+		for (pass = 0; pass < passes; pass++) {
+			vaddr = i915_gem_object_pin_map(obj, I915_MAP_WC);
+			if (IS_ERR(vaddr)) {
+				err = PTR_ERR(vaddr);
+				break;
+			}
+
+			/* Drop the cached mapping, forcing a new one next pass */
+			__i915_gem_object_release_map(obj);
+		}
+		t1 = ktime_get();
+		i915_gem_object_unlock(obj);
+		i915_gem_object_put(obj);
+
+		if (err) {
+			pr_err("%s failed to map %lluMiB object, err=%d\n",
+			       __func__, sizes[i] >> 20, err);
+			break;
+		}
+
+		ns = max_t(u64, ktime_to_ns(ktime_sub(t1, t0)), 1);
+		pr_info("%s: %lluMiB object mapped %lu times in %lluus, %lluMiB/s\n",
+			__func__, sizes[i] >> 20, passes, div_u64(ns, 1000),
+			div64_u64((u64)passes * (sizes[i] >> 20) * NSEC_PER_SEC,
+				  ns));
+
+		cond_resched();
+	}
+
+	return err;
+}
+
 static int igt_lmem_create_with_ps(void *arg)
 {
 	struct drm_i915_private *i915 = arg;
@@ -1387,6 +1454,7 @@ int intel_memory_region_live_selftests(struct drm_i915_private *i915)
 		SUBTEST(igt_lmem_create_cleared_cpu),
 		SUBTEST(igt_lmem_write_cpu),
 		SUBTEST(igt_lmem_write_gpu),
+		SUBTEST(igt_lmem_map_pfn),
 	};
 
 	if (!HAS_LMEM(i915)) {
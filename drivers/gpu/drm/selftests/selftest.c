@@ -0,0 +1,100 @@
+// SPDX-License-Identifier: MIT
+
+/*
+ * Self tests for the parts of drm, TTM and linuxkpi that don't need a
+ * device.
+ *
+ * Loading the drm_selftests module runs all of them and the load fails if
+ * any test does, so
+ *
+ *	kldload drm_selftests && kldunload drm_selftests
+ *
+ * is all a test run takes.  The module is only built with DRM_SELFTESTS
+ * defined.
+ */
+
+#include <sys/param.h>
+#include <sys/kernel.h>
+#include <sys/module.h>
+
+#include <linux/kernel.h>
+#include <linux/sched.h>
+
+#include "selftest.h"
+
+static const struct selftest {
+	const char *name;
+	int (*func)(void);
+} selftests[] = {
+#define selftest(n, f) { .name = #n, .func = f },
+#include "selftests.h"
+#undef selftest
+};
+
+int __subtests(const char *caller, const struct subtest *st, int count,
+	       void *data)
+{
+	int err;
+
+	for (; count--; st++) {
+		cond_resched();
+
+		pr_info("drm: Running %s/%s\n", caller, st->name);
+		err = st->func(data);
+		if (err) {
+			pr_err("drm/%s: %s failed with error %d\n",
+			       caller, st->name, err);
+			return err;
+		}
+	}
+
+	return 0;
+}
+
+static int run_selftests(void)
+{
+	unsigned int i, failed = 0;
+	int err;
+
+	for (i = 0; i < ARRAY_SIZE(selftests); i++) {
+		pr_info("drm: Running %s\n", selftests[i].name);
+		err = selftests[i].func();
+		if (err) {
+			pr_err("drm: %s failed with error %d\n",
+			       selftests[i].name, err);
+			failed++;
+		}
+	}
+
+	pr_info("drm: %u of %zu selftests failed\n",
+		failed, ARRAY_SIZE(selftests));
+
+	return failed ? -EINVAL : 0;
+}
+
+static int
+drm_selftests_modevent(module_t mod, int type, void *data)
+{
+
+	switch (type) {
+	case MOD_LOAD:
+		return (-run_selftests());
+	case MOD_UNLOAD:
+		return (0);
+	default:
+		return (EOPNOTSUPP);
+	}
+}
+
+static moduledata_t drm_selftests_mod = {
+	"drm_selftests",
+	drm_selftests_modevent,
+	NULL
+};
+DECLARE_MODULE(drm_selftests, drm_selftests_mod, SI_SUB_LAST, SI_ORDER_ANY);
+MODULE_VERSION(drm_selftests, 1);
+MODULE_DEPEND(drm_selftests, drmn, 2, 2, 2);
+MODULE_DEPEND(drm_selftests, ttm, 1, 1, 1);
+MODULE_DEPEND(drm_selftests, dmabuf, 1, 1, 1);
+MODULE_DEPEND(drm_selftests, linuxkpi, 1, 1, 1);
+MODULE_DEPEND(drm_selftests, linuxkpi_gplv2, 1, 1, 1);
@@ -0,0 +1,14 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * List each unit test as selftest(name, function)
+ *
+ * The name is used for the log messages, and the function is called with
+ * no arguments and returns 0 on success or a negative errno.
+ *
+ * Tests are executed in the order listed here.
+ */
+selftest(drm_buddy, drm_buddy)
+selftest(drm_mm, drm_mm)
+selftest(ttm_iomem, ttm_iomem)
+selftest(vmap_pfn, vmap_pfn_selftests)
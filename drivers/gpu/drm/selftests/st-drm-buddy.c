@@ -0,0 +1,144 @@
+// SPDX-License-Identifier: MIT
+
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/mm.h>
+#include <linux/random.h>
+#include <linux/slab.h>
+#include <linux/sizes.h>
+
+#include <drm/drm_buddy.h>
+
+#include "selftest.h"
+
+/* A random permutation of [0, count) */
+static unsigned int *random_order(unsigned int count)
+{
+	unsigned int *order, i;
+
+	order = kvmalloc_array(count, sizeof(*order), GFP_KERNEL);
+	if (!order)
+		return NULL;
+
+	for (i = 0; i < count; i++)
+		order[i] = i;
+
+	for (i = count - 1; i > 0; i--)
+		swap(order[i], order[get_random_u32() % (i + 1)]);
+
+	return order;
+}
+
+static int perf_fragmented(void *arg)
+{
+	const u64 size = SZ_256M, chunk = SZ_4K, range = SZ_16M;
+	const unsigned int count = size / chunk;
+	const unsigned long allocs = 1024;
+	const struct {
+		const char *name;
+		u64 start, end;
+		unsigned long flags;
+	} modes[] = {
+		{ "bottom-up", 0, size, 0 },
+		{ "top-down", 0, size, DRM_BUDDY_TOPDOWN_ALLOCATION },
+		{ "range-low", 0, range, DRM_BUDDY_RANGE_ALLOCATION },
+		{ "range-mid", size / 2, size / 2 + range,
+		  DRM_BUDDY_RANGE_ALLOCATION },
+		{ "range-high", size - range, size, DRM_BUDDY_RANGE_ALLOCATION },
+		{}
+	}, *m;
+	struct drm_buddy_block *block, **blocks;
+	unsigned int *order, n;
+	struct drm_buddy mm;
+	LIST_HEAD(held);
+	int err;
+
+	/*
+	 * Fill the manager with single chunks and free a random half of them,
+	 * then time chunk sized allocations in each mode on the fragmented
+	 * result.
+	 */
+
+	err = drm_buddy_init(&mm, size, chunk);
+	if (err)
+		return err;
+
+	blocks = kvmalloc_array(count, sizeof(*blocks), GFP_KERNEL);
+	order = random_order(count);
+	if (!blocks || !order) {
+		err = -ENOMEM;
+		goto out;
+	}
+
+	for (n = 0; n < count; n++) {
+		err = drm_buddy_alloc_blocks(&mm, 0, size, chunk, chunk,
+					     &held, 0);
+		if (err) {
+			pr_err("%s failed to fill at %u, err=%d\n",
+			       __func__, n, err);
+			goto out;
+		}
+		blocks[n] = list_last_entry(&held, typeof(*block), link);
+	}
+
+	for (n = 0; n < count / 2; n++) {
+		block = blocks[order[n]];
+		list_del(&block->link);
+		drm_buddy_free_block(&mm, block);
+	}
+
+	for (m = modes; m->name; m++) {
+		LIST_HEAD(tmp);
+		ktime_t t0, t1;
+
+		t0 = ktime_get();
+		for (n = 0; n < allocs; n++) {
+			err = drm_buddy_alloc_blocks(&mm, m->start, m->end,
+						     chunk, chunk, &tmp,
+						     m->flags);
+			if (err)
+				break;
+		}
+		t1 = ktime_get();
+
+		list_for_each_entry(block, &tmp, link) {
+			u64 offset = drm_buddy_block_offset(block);
+
+			if (offset < m->start ||
+			    offset + drm_buddy_block_size(&mm, block) > m->end) {
+				pr_err("%s %s block %llx outside of [%llx, %llx)\n",
+				       __func__, m->name, offset,
+				       m->start, m->end);
+				err = -EINVAL;
+				break;
+			}
+		}
+		drm_buddy_free_list(&mm, &tmp);
+
+		if (err) {
+			pr_err("%s %s allocation failed, err=%d\n",
+			       __func__, m->name, err);
+			goto out;
+		}
+
+		pr_info("%s: %s %lu allocations, %lluns each\n",
+			__func__, m->name, allocs,
+			div64_u64(ktime_to_ns(ktime_sub(t1, t0)), allocs));
+	}
+
+out:
+	drm_buddy_free_list(&mm, &held);
+	kvfree(order);
+	kvfree(blocks);
+	drm_buddy_fini(&mm);
+	return err;
+}
+
+int drm_buddy(void)
+{
+	static const struct subtest tests[] = {
+		SUBTEST(perf_fragmented),
+	};
+
+	return subtests(tests, NULL);
+}
@@ -0,0 +1,123 @@
+// SPDX-License-Identifier: MIT
+
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/mm.h>
+#include <linux/slab.h>
+#include <linux/sizes.h>
+
+#include <drm/drm_mm.h>
+
+#include "selftest.h"
+
+static int perf_range_insert(void *arg)
+{
+	const struct {
+		const char *name;
+		enum drm_mm_insert_mode mode;
+	} modes[] = {
+		{ "best", DRM_MM_INSERT_BEST },
+		{ "low", DRM_MM_INSERT_LOW },
+		{ "high", DRM_MM_INSERT_HIGH },
+		{}
+	}, *m;
+	const u64 total = SZ_4G, chunk = SZ_64K, range = SZ_256M;
+	const unsigned long count = total / chunk;
+	const unsigned long inserts = 64;
+	struct drm_mm_node *nodes, *tmp;
+	struct drm_mm mm;
+	unsigned long n;
+	int err = 0;
+
+	/*
+	 * Fragment a 4G space the way a busy GGTT looks and time inserts
+	 * restricted to the mappable aperture at its bottom. Outside the
+	 * range the holes are smaller than inside, so a best fit search by
+	 * size alone has to wade through all of them first.
+	 */
+
+	nodes = kvmalloc_array(count, sizeof(*nodes), GFP_KERNEL | __GFP_ZERO);
+	if (!nodes)
+		return -ENOMEM;
+
+	tmp = kvmalloc_array(inserts, sizeof(*tmp), GFP_KERNEL);
+	if (!tmp) {
+		kvfree(nodes);
+		return -ENOMEM;
+	}
+
+	memset(&mm, 0, sizeof(mm));
+	drm_mm_init(&mm, 0, total);
+
+	for (n = 0; n < count; n++) {
+		err = drm_mm_insert_node(&mm, &nodes[n], chunk);
+		if (err) {
+			pr_err("failed to fill the address space at %lu, err=%d\n",
+			       n, err);
+			goto out;
+		}
+	}
+
+	/* Single chunk holes everywhere... */
+	for (n = 0; n < count; n += 2)
+		drm_mm_remove_node(&nodes[n]);
+
+	/* ...a few 5 chunk holes inside the range... */
+	for (n = 1; n + 2 < range / chunk; n += 64) {
+		drm_mm_remove_node(&nodes[n]);
+		drm_mm_remove_node(&nodes[n + 2]);
+	}
+
+	/* ...and many 3 chunk holes outside of it */
+	for (n = range / chunk + 1; n < count; n += 64)
+		drm_mm_remove_node(&nodes[n]);
+
+	for (m = modes; m->name; m++) {
+		ktime_t dt;
+
+		dt = ktime_get();
+		for (n = 0; n < inserts; n++) {
+			memset(&tmp[n], 0, sizeof(tmp[n]));
+			err = drm_mm_insert_node_in_range(&mm, &tmp[n],
+							  2 * chunk, 0, 0,
+							  0, range, m->mode);
+			if (err)
+				break;
+		}
+		dt = ktime_sub(ktime_get(), dt);
+
+		while (n--) {
+			if (!err && tmp[n].start + tmp[n].size > range) {
+				pr_err("%s insert outside of the range at %llx\n",
+				       m->name, tmp[n].start);
+				err = -EINVAL;
+			}
+			drm_mm_remove_node(&tmp[n]);
+		}
+		if (err) {
+			pr_err("%s insert failed, err=%d\n", m->name, err);
+			goto out;
+		}
+
+		pr_info("%s: %lu range restricted inserts, %lluns each\n",
+			m->name, inserts, div64_u64(ktime_to_ns(dt), inserts));
+	}
+
+out:
+	for (n = 0; n < count; n++)
+		if (drm_mm_node_allocated(&nodes[n]))
+			drm_mm_remove_node(&nodes[n]);
+	drm_mm_takedown(&mm);
+	kvfree(tmp);
+	kvfree(nodes);
+	return err;
+}
+
+int drm_mm(void)
+{
+	static const struct subtest tests[] = {
+		SUBTEST(perf_range_insert),
+	};
+
+	return subtests(tests, NULL);
+}
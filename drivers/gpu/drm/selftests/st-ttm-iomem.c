@@ -0,0 +1,271 @@
+// SPDX-License-Identifier: MIT
+
+#include <linux/dma-resv.h>
+#include <linux/gfp.h>
+#include <linux/io.h>
+#include <linux/iosys-map.h>
+#include <linux/ktime.h>
+#include <linux/mm.h>
+#include <linux/slab.h>
+#include <linux/sort.h>
+
+#include <drm/ttm/ttm_bo_api.h>
+#include <drm/ttm/ttm_bo_driver.h>
+#include <drm/ttm/ttm_device.h>
+#include <drm/ttm/ttm_placement.h>
+#include <drm/ttm/ttm_resource.h>
+
+#ifdef CONFIG_X86_64
+#include <asm/set_memory.h>
+#endif
+
+#include "selftest.h"
+
+/* 1M of "iomem" per buffer object */
+#define MOCK_IOMEM_ORDER	8
+
+/*
+ * A buffer object in an iomem resource which is really a chunk of RAM, so
+ * that the kmap and vmap paths of TTM can be timed without a device. Only
+ * the fields those paths look at are set up.
+ */
+struct mock_iomem {
+	struct ttm_device bdev;
+	struct ttm_buffer_object bo;
+	struct ttm_resource res;
+	struct page *pages;
+	enum ttm_caching caching;
+};
+
+static const char *const caching_names[] = {
+	[ttm_uncached] = "uc",
+	[ttm_write_combined] = "wc",
+	[ttm_cached] = "wb",
+};
+
+/* Cached last, it puts the direct map of the pages back to write-back */
+static const enum ttm_caching cachings[] = {
+	ttm_uncached,
+	ttm_write_combined,
+	ttm_cached,
+};
+
+static int mock_io_mem_reserve(struct ttm_device *bdev,
+			       struct ttm_resource *mem)
+{
+	struct mock_iomem *mock = container_of(bdev, typeof(*mock), bdev);
+
+	mem->bus.offset = page_to_phys(mock->pages) + (mem->start << PAGE_SHIFT);
+	mem->bus.is_iomem = true;
+	mem->bus.caching = mock->caching;
+
+	return 0;
+}
+
+static struct ttm_device_funcs mock_iomem_funcs = {
+	.io_mem_reserve = mock_io_mem_reserve,
+};
+
+static struct mock_iomem *mock_iomem_create(void)
+{
+	const unsigned long num_pages = 1ul << MOCK_IOMEM_ORDER;
+	struct mock_iomem *mock;
+	unsigned long i;
+	u32 *vaddr;
+
+	mock = kzalloc(sizeof(*mock), GFP_KERNEL);
+	if (!mock)
+		return NULL;
+
+	mock->pages = alloc_pages(GFP_KERNEL, MOCK_IOMEM_ORDER);
+	if (!mock->pages) {
+		kfree(mock);
+		return NULL;
+	}
+
+	/* Each dword holds its own index, see mock_iomem_check() */
+	for (i = 0; i < num_pages; i++) {
+		unsigned int n;
+
+		vaddr = page_address(mock->pages + i);
+		for (n = 0; n < PAGE_SIZE / sizeof(*vaddr); n++)
+			vaddr[n] = i * (PAGE_SIZE / sizeof(*vaddr)) + n;
+	}
+
+	mock->bdev.funcs = &mock_iomem_funcs;
+
+	mock->res.start = 0;
+	mock->res.num_pages = num_pages;
+	mock->res.mem_type = TTM_PL_VRAM;
+	mock->res.bo = &mock->bo;
+
+	mock->bo.bdev = &mock->bdev;
+	mock->bo.resource = &mock->res;
+	mock->bo.base.size = num_pages << PAGE_SHIFT;
+	dma_resv_init(&mock->bo.base._resv);
+	mock->bo.base.resv = &mock->bo.base._resv;
+
+	return mock;
+}
+
+static void mock_iomem_free(struct mock_iomem *mock)
+{
+#ifdef CONFIG_X86_64
+	/* ioremap() of RAM changes the direct map, make sure it's undone */
+	set_pages_wb(mock->pages, 1 << MOCK_IOMEM_ORDER);
+#endif
+	__free_pages(mock->pages, MOCK_IOMEM_ORDER);
+	dma_resv_fini(&mock->bo.base._resv);
+	kfree(mock);
+}
+
+/* Read the whole mapping a dword at a time and check the contents */
+static int mock_iomem_check(const void __iomem *vaddr, size_t size)
+{
+	size_t n;
+
+	for (n = 0; n < size / sizeof(u32); n++) {
+		u32 val = readl(vaddr + n * sizeof(u32));
+
+		if (val != n) {
+			pr_err("dword %zu reads %08x\n", n, val);
+			return -EINVAL;
+		}
+	}
+
+	return 0;
+}
+
+static int wrap_ktime_compare(const void *A, const void *B)
+{
+	const ktime_t *a = A, *b = B;
+
+	return ktime_compare(*a, *b);
+}
+
+static void report(const char *caller, enum ttm_caching caching,
+		   size_t size, ktime_t *t, unsigned int count)
+{
+	sort(t, count, sizeof(*t), wrap_ktime_compare, NULL);
+	if (t[0] <= 0)
+		return;
+
+	pr_info("%s %s %4zu KiB map+read: %5lld MiB/s\n",
+		caller, caching_names[caching], size >> 10,
+		div64_u64((u64)4 * size * NSEC_PER_SEC,
+			  t[1] + 2 * t[2] + t[3]) >> 20);
+}
+
+static int perf_kmap_read(void *arg)
+{
+	struct mock_iomem *mock = arg;
+	const size_t size = mock->bo.base.size;
+	unsigned int i, pass;
+	ktime_t t[5];
+	int err = 0;
+
+	for (i = 0; i < ARRAY_SIZE(cachings); i++) {
+		mock->caching = cachings[i];
+
+		for (pass = 0; pass < ARRAY_SIZE(t); pass++) {
+			struct ttm_bo_kmap_obj map;
+			bool is_iomem;
+			void *vaddr;
+			ktime_t t0;
+
+			t0 = ktime_get();
+			err = ttm_bo_kmap(&mock->bo, 0, mock->res.num_pages,
+					  &map);
+			if (err)
+				return err;
+
+			vaddr = ttm_kmap_obj_virtual(&map, &is_iomem);
+			if (!is_iomem || map.bo_kmap_type != ttm_bo_map_iomap) {
+				pr_err("kmap of an iomem resource not ioremapped\n");
+				err = -EINVAL;
+			} else {
+				err = mock_iomem_check((void __iomem *)vaddr,
+						       size);
+			}
+			ttm_bo_kunmap(&map);
+			t[pass] = ktime_sub(ktime_get(), t0);
+			if (err)
+				return err;
+		}
+
+		report(__func__, mock->caching, size, t, ARRAY_SIZE(t));
+		cond_resched();
+	}
+
+	return 0;
+}
+
+static int perf_vmap_read(void *arg)
+{
+	struct mock_iomem *mock = arg;
+	const size_t size = mock->bo.base.size;
+	unsigned int i, pass;
+	ktime_t t[5];
+	int err = 0;
+
+	dma_resv_lock(mock->bo.base.resv, NULL);
+	for (i = 0; i < ARRAY_SIZE(cachings); i++) {
+		mock->caching = cachings[i];
+
+		for (pass = 0; pass < ARRAY_SIZE(t); pass++) {
+			struct iosys_map map;
+			ktime_t t0;
+
+			t0 = ktime_get();
+			err = ttm_bo_vmap(&mock->bo, &map);
+			if (err)
+				goto out;
+
+			if (!map.is_iomem) {
+				pr_err("vmap of an iomem resource not ioremapped\n");
+				err = -EINVAL;
+			} else {
+				err = mock_iomem_check(map.vaddr_iomem, size);
+			}
+			ttm_bo_vunmap(&mock->bo, &map);
+			t[pass] = ktime_sub(ktime_get(), t0);
+			if (err)
+				goto out;
+		}
+
+		report(__func__, mock->caching, size, t, ARRAY_SIZE(t));
+		cond_resched();
+	}
+out:
+	dma_resv_unlock(mock->bo.base.resv);
+	return err;
+}
+
+int ttm_iomem(void)
+{
+	static const struct subtest tests[] = {
+		SUBTEST(perf_kmap_read),
+		SUBTEST(perf_vmap_read),
+	};
+	struct mock_iomem *mock;
+	int err;
+
+#ifndef CONFIG_X86_64
+	/*
+	 * Only amd64 ioremap()s RAM by changing the memory type of its direct
+	 * map, elsewhere we would create an alias with a conflicting type.
+	 */
+	pr_info("%s: skipped, RAM can only stand in for iomem on amd64\n",
+		__func__);
+	return 0;
+#endif
+
+	mock = mock_iomem_create();
+	if (!mock)
+		return -ENOMEM;
+
+	err = subtests(tests, mock);
+
+	mock_iomem_free(mock);
+	return err;
+}
@@ -0,0 +1,240 @@
+// SPDX-License-Identifier: MIT
+
+#include <linux/gfp.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/mm.h>
+#include <linux/sizes.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+
+#include "selftest.h"
+
+/* Enough single page mappings to put several in every hash bucket */
+#define VMAP_PFN_MAPPINGS	257
+
+struct vmap_pfn_pages {
+	unsigned int count;
+	unsigned long *pfns;
+	struct page **pages;
+};
+
+static void pages_free(struct vmap_pfn_pages *p)
+{
+	unsigned int i;
+
+	for (i = 0; i < p->count; i++)
+		if (p->pages[i])
+			__free_page(p->pages[i]);
+	kfree(p->pages);
+	kfree(p->pfns);
+}
+
+/*
+ * Allocate @count single pages, listed in reverse so that the pfns are not
+ * contiguous, and fill each dword with its index within the whole range.
+ */
+static int pages_alloc(struct vmap_pfn_pages *p, unsigned int count)
+{
+	unsigned int i, n;
+	u32 *vaddr;
+
+	p->count = count;
+	p->pfns = kcalloc(count, sizeof(*p->pfns), GFP_KERNEL);
+	p->pages = kcalloc(count, sizeof(*p->pages), GFP_KERNEL);
+	if (!p->pfns || !p->pages)
+		goto err;
+
+	for (i = count; i--; ) {
+		p->pages[i] = alloc_page(GFP_KERNEL);
+		if (!p->pages[i])
+			goto err;
+
+		p->pfns[i] = page_to_pfn(p->pages[i]);
+		vaddr = page_address(p->pages[i]);
+		for (n = 0; n < PAGE_SIZE / sizeof(*vaddr); n++)
+			vaddr[n] = i * (PAGE_SIZE / sizeof(*vaddr)) + n;
+	}
+
+	return 0;
+
+err:
+	pages_free(p);
+	return -ENOMEM;
+}
+
+static int check_map(const u32 *vaddr, unsigned int first, unsigned int count)
+{
+	const unsigned int dw = PAGE_SIZE / sizeof(*vaddr);
+	unsigned int n;
+
+	for (n = 0; n < count * dw; n++) {
+		if (vaddr[n] != first * dw + n) {
+			pr_err("dword %u of page %u reads %08x\n",
+			       n % dw, first + n / dw, vaddr[n]);
+			return -EINVAL;
+		}
+	}
+
+	return 0;
+}
+
+static int igt_ram(void *arg)
+{
+	struct vmap_pfn_pages p;
+	u32 *vaddr, *direct;
+	int err;
+
+	/*
+	 * RAM mapped with vmap_pfn() keeps the memory type of its vm_page
+	 * whatever the pgprot asks for, so writes through the mapping must be
+	 * visible through the direct map right away and vice versa.
+	 */
+
+	err = pages_alloc(&p, 16);
+	if (err)
+		return err;
+
+	vaddr = vmap_pfn(p.pfns, p.count, pgprot_writecombine(PAGE_KERNEL));
+	if (!vaddr) {
+		err = -ENOMEM;
+		goto out;
+	}
+
+	if (!linuxkpi_is_vmap_pfn_addr(vaddr)) {
+		pr_err("vmap_pfn() mapping %p outside of its window\n", vaddr);
+		err = -EINVAL;
+		goto out_unmap;
+	}
+
+	err = check_map(vaddr, 0, p.count);
+	if (err)
+		goto out_unmap;
+
+	direct = page_address(p.pages[p.count - 1]);
+	vaddr[p.count * PAGE_SIZE / sizeof(*vaddr) - 1] = 0xdeadbeef;
+	if (READ_ONCE(direct[PAGE_SIZE / sizeof(*direct) - 1]) != 0xdeadbeef) {
+		pr_err("write through vmap_pfn() not seen by the direct map\n");
+		err = -EINVAL;
+	}
+
+out_unmap:
+	vunmap(vaddr);
+out:
+	pages_free(&p);
+	return err;
+}
+
+static int igt_many(void *arg)
+{
+	struct vmap_pfn_pages p;
+	void **maps, *vmalloced;
+	unsigned int i;
+	int err = 0;
+
+	/*
+	 * Keep lots of mappings alive at once and tear them down out of order,
+	 * every vunmap() has to find its own entry in the shared hash buckets.
+	 * A plain vmalloc() address in between must still go to the base
+	 * vunmap().
+	 */
+
+	err = pages_alloc(&p, VMAP_PFN_MAPPINGS);
+	if (err)
+		return err;
+
+	maps = kcalloc(p.count, sizeof(*maps), GFP_KERNEL);
+	vmalloced = vmalloc(PAGE_SIZE);
+	if (!maps || !vmalloced) {
+		err = -ENOMEM;
+		goto out;
+	}
+
+	if (linuxkpi_is_vmap_pfn_addr(vmalloced)) {
+		pr_err("vmalloc() address %p in the vmap_pfn() window\n",
+		       vmalloced);
+		err = -EINVAL;
+		goto out;
+	}
+
+	for (i = 0; i < p.count; i++) {
+		maps[i] = vmap_pfn(&p.pfns[i], 1, PAGE_KERNEL);
+		if (!maps[i]) {
+			err = -ENOMEM;
+			goto out;
+		}
+	}
+
+	/* Every other mapping first, then the rest from the back */
+	for (i = 0; i < p.count; i += 2) {
+		err = check_map(maps[i], i, 1);
+		if (err)
+			goto out;
+		vunmap(maps[i]);
+		maps[i] = NULL;
+	}
+	for (i = p.count; i--; ) {
+		if (!maps[i])
+			continue;
+		err = check_map(maps[i], i, 1);
+		if (err)
+			goto out;
+		vunmap(maps[i]);
+		maps[i] = NULL;
+	}
+
+out:
+	for (i = 0; maps && i < p.count; i++)
+		if (maps[i])
+			vunmap(maps[i]);
+	kfree(maps);
+	vfree(vmalloced);
+	pages_free(&p);
+	return err;
+}
+
+static int perf_map(void *arg)
+{
+	const unsigned int count = SZ_2M >> PAGE_SHIFT;
+	const unsigned long passes = 256;
+	struct vmap_pfn_pages p;
+	unsigned long pass;
+	ktime_t t0, t1;
+	void *vaddr;
+	int err;
+
+	err = pages_alloc(&p, count);
+	if (err)
+		return err;
+
+	t0 = ktime_get();
+	for (pass = 0; pass < passes; pass++) {
+		vaddr = vmap_pfn(p.pfns, count, PAGE_KERNEL);
+		if (!vaddr) {
+			err = -ENOMEM;
+			break;
+		}
+		vunmap(vaddr);
+	}
+	t1 = ktime_get();
+
+	if (!err)
+		pr_info("%s: 2MiB mapped and unmapped %lu times, %lluns each\n",
+			__func__, passes,
+			div64_u64(ktime_to_ns(ktime_sub(t1, t0)), passes));
+
+	pages_free(&p);
+	return err;
+}
+
+/* Not vmap_pfn(), that is a macro from <linux/vmalloc.h> */
+int vmap_pfn_selftests(void)
+{
+	static const struct subtest tests[] = {
+		SUBTEST(igt_ram),
+		SUBTEST(igt_many),
+		SUBTEST(perf_map),
+	};
+
+	return subtests(tests, NULL);
+}
@@ -969,6 +969,7 @@ int ttm_bo_init_reserved(struct ttm_device *bdev, struct ttm_buffer_object *bo,
 	bo->page_alignment = alignment;
 	bo->destroy = destroy;
 	bo->pin_count = 0;
+	memset(&bo->vm_stats, 0, sizeof(bo->vm_stats));
 	bo->sg = sg;
 	bo->bulk_move = NULL;
 	if (resv)
@@ -42,12 +42,6 @@
 #include <linux/module.h>
 #include <linux/dma-resv.h>
 
-#if defined(__FreeBSD__)
-			/* FIXME BSD not sure, whether this is right? */
-			/* linuxkpi does not (yet?) know ioremap_cache */
-#define ioremap_cache ioremap_nocache
-#endif
-
 struct ttm_transfer_obj {
 	struct ttm_buffer_object base;
 	struct ttm_buffer_object *bo;
@@ -302,7 +296,7 @@ static int ttm_bo_ioremap(struct ttm_buffer_object *bo,
 		map->bo_kmap_type = ttm_bo_map_iomap;
 		if (mem->bus.caching == ttm_write_combined)
 			map->virtual = ioremap_wc(res, size);
-#ifdef CONFIG_X86
+#if defined(CONFIG_X86) || defined(__FreeBSD__)
 		else if (mem->bus.caching == ttm_cached)
 			map->virtual = ioremap_cache(res, size);
 #endif
@@ -425,7 +419,7 @@ int ttm_bo_vmap(struct ttm_buffer_object *bo, struct iosys_map *map)
 		else if (mem->bus.caching == ttm_write_combined)
 			vaddr_iomem = ioremap_wc(mem->bus.offset,
 						 bo->base.size);
-#ifdef CONFIG_X86
+#if defined(CONFIG_X86) || defined(__FreeBSD__)
 		else if (mem->bus.caching == ttm_cached)
 			vaddr_iomem = ioremap_cache(mem->bus.offset,
 						  bo->base.size);
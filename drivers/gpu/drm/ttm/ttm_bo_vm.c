@@ -165,6 +165,107 @@ vm_fault_t ttm_bo_vm_reserve(struct ttm_buffer_object *bo,
 }
 EXPORT_SYMBOL(ttm_bo_vm_reserve);
 
+/*
+ * Account the fault and return the number of pages to prefault for it.
+ *
+ * A fault right behind the previous prefault window means the access is
+ * sequential and everything prefaulted last time got used, so the window is
+ * doubled up to TTM_BO_VM_MAX_PREFAULT. Any other fault resets it to what the
+ * caller asked for. Callers asking for a single page never get more.
+ */
+static pgoff_t ttm_bo_vm_prefault_window(struct ttm_buffer_object *bo,
+					 unsigned long page_offset,
+					 pgoff_t num_prefault)
+{
+	struct ttm_bo_vm_stats *stats = &bo->vm_stats;
+
+	stats->faults++;
+
+	if (stats->window && page_offset == stats->next_offset) {
+		stats->prefault_hits += stats->last_prefaulted;
+		if (num_prefault > 1)
+			stats->window = min_t(unsigned long, stats->window * 2,
+					      max_t(pgoff_t, num_prefault,
+						    TTM_BO_VM_MAX_PREFAULT));
+	} else {
+		stats->window = num_prefault;
+	}
+
+	return stats->window;
+}
+
+#ifdef __FreeBSD__
+static bool ttm_bo_vm_pfn(struct ttm_buffer_object *bo,
+			  unsigned long page_offset, unsigned long *pfn)
+{
+	struct page *page;
+
+	if (bo->resource->bus.is_iomem) {
+		*pfn = ttm_bo_io_mem_pfn(bo, page_offset);
+		return true;
+	}
+
+	page = bo->ttm->pages[page_offset];
+	if (!page)
+		return false;
+
+	*pfn = page_to_pfn(page);
+	return true;
+}
+
+/*
+ * Check whether the superpage sized chunk around the faulting page is backed
+ * by physically contiguous memory with the same alignment. If so move the
+ * fault to the start of the chunk and make sure the whole chunk is inserted,
+ * so that the pager can map it with a single superpage.
+ *
+ * Pages of external ttm_tts are handed back to their owner without TTM
+ * getting a chance to clear the superpage hint, so they always use 4K.
+ *
+ * Return: The number of pages in the chunk or zero if it can't be used.
+ */
+static pgoff_t ttm_bo_vm_fault_huge(struct ttm_buffer_object *bo,
+				    struct vm_area_struct *vma,
+				    unsigned long *address,
+				    unsigned long *page_offset,
+				    unsigned long page_last,
+				    pgoff_t *num_prefault)
+{
+	unsigned long addr, start, pfn, next, i;
+	pgoff_t npages;
+
+	if (pagesizes[1] == 0 || *num_prefault <= 1)
+		return 0;
+
+	if (!bo->resource->bus.is_iomem &&
+	    bo->ttm->page_flags & TTM_TT_FLAG_EXTERNAL)
+		return 0;
+
+	npages = atop(pagesizes[1]);
+	addr = rounddown2(*address, pagesizes[1]);
+	i = atop(*address - addr);
+	if (addr < vma->vm_start || i > *page_offset)
+		return 0;
+
+	start = *page_offset - i;
+	if (start + npages > page_last)
+		return 0;
+
+	if (!ttm_bo_vm_pfn(bo, start, &pfn) || (pfn & (npages - 1)))
+		return 0;
+
+	for (i = 1; i < npages; ++i)
+		if (!ttm_bo_vm_pfn(bo, start + i, &next) || next != pfn + i)
+			return 0;
+
+	*num_prefault = max_t(pgoff_t, *num_prefault + *page_offset - start,
+			      npages);
+	*address = addr;
+	*page_offset = start;
+	return npages;
+}
+#endif
+
 /**
  * ttm_bo_vm_fault_reserved - TTM fault helper
  * @vmf: The struct vm_fault given as argument to the fault callback
@@ -192,7 +293,8 @@ vm_fault_t ttm_bo_vm_fault_reserved(struct vm_fault *vmf,
 	struct ttm_device *bdev = bo->bdev;
 	unsigned long page_offset;
 	unsigned long page_last;
-	unsigned long pfn;
+	unsigned long pfn, run, j;
+	pgoff_t huge = 0;
 	struct ttm_tt *ttm = NULL;
 	struct page *page;
 	int err;
@@ -239,13 +341,27 @@ vm_fault_t ttm_bo_vm_fault_reserved(struct vm_fault *vmf,
 		prot = pgprot_decrypted(prot);
 	}
 
+	num_prefault = ttm_bo_vm_prefault_window(bo, page_offset, num_prefault);
+	page_last = min_t(unsigned long, page_last, bo->resource->num_pages);
+#ifdef __FreeBSD__
+	huge = ttm_bo_vm_fault_huge(bo, vma, &address, &page_offset, page_last,
+				    &num_prefault);
+#endif
+
 	/*
-	 * Speculatively prefault a number of pages. Only error on
-	 * first page.
+	 * Speculatively prefault a number of pages, a physically contiguous
+	 * run at a time. Only error on first page.
 	 */
-	for (i = 0; i < num_prefault; ++i) {
+	for (i = 0; i < num_prefault; i += run) {
+		unsigned long max = min_t(unsigned long, num_prefault - i,
+					  page_last - page_offset);
+
 		if (bo->resource->bus.is_iomem) {
 			pfn = ttm_bo_io_mem_pfn(bo, page_offset);
+			for (run = 1; run < max; ++run)
+				if (ttm_bo_io_mem_pfn(bo, page_offset + run) !=
+				    pfn + run)
+					break;
 		} else {
 			page = ttm->pages[page_offset];
 			if (unlikely(!page && i == 0)) {
@@ -253,10 +369,17 @@ vm_fault_t ttm_bo_vm_fault_reserved(struct vm_fault *vmf,
 			} else if (unlikely(!page)) {
 				break;
 			}
+			pfn = page_to_pfn(page);
+			for (run = 1; run < max; ++run) {
+				page = ttm->pages[page_offset + run];
+				if (!page || page_to_pfn(page) != pfn + run)
+					break;
+			}
 #if defined(__FreeBSD__)
-			page->oflags &= ~VPO_UNMANAGED;
+			for (j = 0; j < run; ++j)
+				ttm->pages[page_offset + j]->oflags &=
+					~VPO_UNMANAGED;
 #endif
-			pfn = page_to_pfn(page);
 		}
 
 		/*
@@ -268,23 +391,41 @@ vm_fault_t ttm_bo_vm_fault_reserved(struct vm_fault *vmf,
 		 * See vmf_insert_mixed_prot() for a discussion.
 		 */
 #ifdef __linux__
-		ret = vmf_insert_pfn_prot(vma, address, pfn, prot);
+		for (j = 0; j < run; ++j) {
+			ret = vmf_insert_pfn_prot(vma, address + j * PAGE_SIZE,
+						  pfn + j, prot);
+			if (unlikely(ret & VM_FAULT_ERROR))
+				break;
+		}
 #elif defined(__FreeBSD__)
-		ret = lkpi_vmf_insert_pfn_prot_locked(vma, address, pfn, prot);
+		j = run;
+		ret = lkpi_vmf_insert_pfn_range_prot_locked(vma, address, pfn,
+							    &j, prot, huge != 0);
 #endif
 
 		/* Never error on prefaulted PTEs */
-		if (unlikely((ret & VM_FAULT_ERROR))) {
-			if (i == 0)
+		if (unlikely(j < run)) {
+			if (i + j == 0)
 				return VM_FAULT_NOPAGE;
-			else
-				break;
+
+			i += j;
+			page_offset += j;
+			break;
 		}
 
-		address += PAGE_SIZE;
-		if (unlikely(++page_offset >= page_last))
+		address += run * PAGE_SIZE;
+		page_offset += run;
+		if (unlikely(page_offset >= page_last)) {
+			i += run;
 			break;
+		}
 	}
+
+	bo->vm_stats.next_offset = page_offset;
+	bo->vm_stats.last_prefaulted = i ? i - 1 : 0;
+	bo->vm_stats.prefaulted += bo->vm_stats.last_prefaulted;
+	if (huge && i >= huge)
+		bo->vm_stats.huge_faults++;
 #ifdef __FreeBSD__
 	VM_OBJECT_WUNLOCK(vma->vm_obj);
 #endif
@@ -65,12 +65,52 @@ struct ttm_pool_dma {
 	unsigned long vaddr;
 };
 
+/* Upper bound of pages cleared by the worker before dropping the lock */
+#define TTM_POOL_CLEAR_BATCH	512
+
+/* Entries per CPU magazine and number of entries moved at once */
+#define TTM_POOL_MAG_SIZE	16
+#define TTM_POOL_MAG_BATCH	(TTM_POOL_MAG_SIZE / 2)
+
+/* Only the lower orders get magazines, higher ones would pin too much memory */
+#define TTM_POOL_MAG_MAX_ORDER	3
+
+/**
+ * struct ttm_pool_magazine - Per CPU LIFO of pages for a pool_type
+ *
+ * @lock: protects the magazine, only contended when draining it remotely
+ * @count: number of valid entries in @pages
+ * @hits: allocations served from the magazine
+ * @misses: allocations which needed to refill the magazine first
+ * @pages: the cached entries, each of 1 << order pages
+ *
+ * Magazines are bounded to TTM_POOL_MAG_SIZE entries per CPU and accounted in
+ * allocated_pages like the shared lists, the shrinker drains them once the
+ * shared lists of a pool_type run empty. Magazines only ever hold cleared
+ * pages, in deferred clear mode pages given back go to the clear worker and
+ * reach the magazines through a refill from the shared list.
+ */
+struct ttm_pool_magazine {
+	spinlock_t lock;
+	unsigned int count;
+	unsigned long hits;
+	unsigned long misses;
+	struct page *pages[TTM_POOL_MAG_SIZE];
+} ____cacheline_aligned_in_smp;
+
 static unsigned long page_pool_size;
 
 MODULE_PARM_DESC(page_pool_size, "Number of pages in the WC/UC/DMA pool");
 module_param(page_pool_size, ulong, 0644);
 
+static bool page_pool_deferred_clear = true;
+
+MODULE_PARM_DESC(page_pool_deferred_clear,
+		 "Clear pages given back to the pool from a worker (default: true)");
+module_param(page_pool_deferred_clear, bool, 0644);
+
 static atomic_long_t allocated_pages;
+static atomic_long_t dirty_pages;
 
 static struct ttm_pool_type global_write_combined[MAX_ORDER];
 static struct ttm_pool_type global_uncached[MAX_ORDER];
@@ -149,6 +189,9 @@ static void ttm_pool_free_page(struct ttm_pool *pool, enum ttm_caching caching,
 	unsigned long attr = DMA_ATTR_FORCE_CONTIGUOUS;
 	struct ttm_pool_dma *dma;
 	void *vaddr;
+#ifdef __FreeBSD__
+	unsigned int i;
+#endif
 
 #ifdef CONFIG_X86
 	/* We don't care that set_pages_wb is inefficient here. This is only
@@ -157,6 +200,11 @@ static void ttm_pool_free_page(struct ttm_pool *pool, enum ttm_caching caching,
 	if (caching != ttm_cached && !PageHighMem(p))
 		set_pages_wb(p, 1 << order);
 #endif
+#ifdef __FreeBSD__
+	/* The fault handler may have flagged the pages for superpage mappings */
+	for (i = 0; i < (1 << order); ++i)
+		p[i].psind = 0;
+#endif
 
 	if (!pool || !pool->use_dma_alloc) {
 		__free_pages(p, order);
@@ -240,8 +288,8 @@ static void ttm_pool_unmap(struct ttm_pool *pool, dma_addr_t dma_addr,
 		       DMA_BIDIRECTIONAL);
 }
 
-/* Give pages into a specific pool_type */
-static void ttm_pool_type_give(struct ttm_pool_type *pt, struct page *p)
+/* Clear the 1 << order pages of a pool_type entry */
+static void ttm_pool_clear_pages(struct ttm_pool_type *pt, struct page *p)
 {
 	unsigned int i, num_pages = 1 << pt->order;
 
@@ -255,34 +303,189 @@ static void ttm_pool_type_give(struct ttm_pool_type *pt, struct page *p)
 		pmap_zero_page(p + i);
 #endif
 	}
+}
 
-	spin_lock(&pt->lock);
+/* Lock the shared lists of a pool_type and account for contention */
+static void ttm_pool_type_lock(struct ttm_pool_type *pt)
+{
+	bool contended = !spin_trylock(&pt->lock);
+
+	if (contended)
+		spin_lock(&pt->lock);
+
+	pt->lock_count++;
+	if (contended)
+		pt->lock_contended++;
+}
+
+/* Return the magazine of the current CPU, NULL if the pool_type has none */
+static struct ttm_pool_magazine *ttm_pool_type_mag(struct ttm_pool_type *pt)
+{
+	if (!pt->mags)
+		return NULL;
+
+	/* Getting migrated afterwards is harmless, the magazine is locked */
+	return &pt->mags[raw_smp_processor_id()];
+}
+
+/* Move up to @count entries from the bottom of a magazine to the shared list */
+static void ttm_pool_mag_drain(struct ttm_pool_type *pt,
+			       struct ttm_pool_magazine *mag,
+			       unsigned int count)
+{
+	unsigned int i;
+
+	count = min(count, mag->count);
+	if (!count)
+		return;
+
+	ttm_pool_type_lock(pt);
+	for (i = 0; i < count; ++i) {
 #ifdef __linux__
-	list_add(&p->lru, &pt->pages);
+		list_add(&mag->pages[i]->lru, &pt->pages);
 #elif defined(__FreeBSD__)
-	TAILQ_INSERT_HEAD(&pt->pages, p, plinks.q);
+		TAILQ_INSERT_HEAD(&pt->pages, mag->pages[i], plinks.q);
 #endif
+	}
 	spin_unlock(&pt->lock);
+
+	mag->count -= count;
+	memmove(mag->pages, mag->pages + count,
+		mag->count * sizeof(*mag->pages));
+}
+
+/* Refill an empty magazine with a batch of cleared pages from the shared list */
+static void ttm_pool_mag_refill(struct ttm_pool_type *pt,
+				struct ttm_pool_magazine *mag)
+{
+	struct page *p;
+
+	ttm_pool_type_lock(pt);
+	while (mag->count < TTM_POOL_MAG_BATCH) {
+#ifdef __linux__
+		p = list_first_entry_or_null(&pt->pages, typeof(*p), lru);
+		if (!p)
+			break;
+		list_del(&p->lru);
+#elif defined(__FreeBSD__)
+		p = TAILQ_FIRST(&pt->pages);
+		if (!p)
+			break;
+		TAILQ_REMOVE(&pt->pages, p, plinks.q);
+#endif
+		mag->pages[mag->count++] = p;
+	}
+	spin_unlock(&pt->lock);
+}
+
+/* Move all pages cached in the magazines back to the shared list */
+static void ttm_pool_type_drain_mags(struct ttm_pool_type *pt)
+{
+	struct ttm_pool_magazine *mag;
+	unsigned int cpu;
+
+	if (!pt->mags)
+		return;
+
+	for (cpu = 0; cpu < nr_cpu_ids; ++cpu) {
+		mag = &pt->mags[cpu];
+
+		spin_lock(&mag->lock);
+		ttm_pool_mag_drain(pt, mag, mag->count);
+		spin_unlock(&mag->lock);
+	}
+}
+
+/* Give pages into a specific pool_type */
+static void ttm_pool_type_give(struct ttm_pool_type *pt, struct page *p)
+{
+	bool defer = page_pool_deferred_clear;
+	struct ttm_pool_magazine *mag;
+#ifdef __FreeBSD__
+	unsigned int i;
+
+	/* Don't keep a superpage hint from the last mapping around */
+	for (i = 0; i < (1 << pt->order); ++i)
+		p[i].psind = 0;
+#endif
+
+	if (!defer)
+		ttm_pool_clear_pages(pt, p);
+
 	atomic_long_add(1 << pt->order, &allocated_pages);
+
+	/*
+	 * Dirty pages bypass the magazines, otherwise the next allocation on
+	 * this CPU would take them and clear them inline while the worker has
+	 * clean ones ready.
+	 */
+	mag = defer ? NULL : ttm_pool_type_mag(pt);
+	if (mag) {
+		spin_lock(&mag->lock);
+		if (mag->count == TTM_POOL_MAG_SIZE)
+			ttm_pool_mag_drain(pt, mag, TTM_POOL_MAG_BATCH);
+		mag->pages[mag->count++] = p;
+		spin_unlock(&mag->lock);
+		return;
+	}
+
+	if (defer)
+		atomic_long_add(1 << pt->order, &dirty_pages);
+
+	ttm_pool_type_lock(pt);
+#ifdef __linux__
+	list_add(&p->lru, defer ? &pt->dirty : &pt->pages);
+#elif defined(__FreeBSD__)
+	TAILQ_INSERT_HEAD(defer ? &pt->dirty : &pt->pages, p, plinks.q);
+#endif
+	spin_unlock(&pt->lock);
+
+	if (defer)
+		queue_work(system_unbound_wq, &pt->clear_work);
 }
 
-/* Take pages from a specific pool_type, return NULL when nothing available */
-static struct page *ttm_pool_type_take(struct ttm_pool_type *pt)
+/*
+ * Take pages from a specific pool_type, return NULL when nothing available.
+ *
+ * With @want_clean set cleared pages are preferred, otherwise the pages still
+ * waiting for the clear worker are handed out first. @dirty tells the caller
+ * if the returned pages still need to be cleared.
+ */
+static struct page *__ttm_pool_type_take(struct ttm_pool_type *pt,
+					 bool want_clean, bool *dirty)
 {
 	struct page *p;
 
-	spin_lock(&pt->lock);
+	ttm_pool_type_lock(pt);
 #ifdef __linux__
-	p = list_first_entry_or_null(&pt->pages, typeof(*p), lru);
+	p = NULL;
+	if (want_clean)
+		p = list_first_entry_or_null(&pt->pages, typeof(*p), lru);
+	*dirty = !p;
+	if (!p)
+		p = list_first_entry_or_null(&pt->dirty, typeof(*p), lru);
+	if (!p && !want_clean) {
+		p = list_first_entry_or_null(&pt->pages, typeof(*p), lru);
+		*dirty = false;
+	}
 #elif defined(__FreeBSD__)
-	p = TAILQ_FIRST(&pt->pages);
+	p = want_clean ? TAILQ_FIRST(&pt->pages) : NULL;
+	*dirty = !p;
+	if (!p)
+		p = TAILQ_FIRST(&pt->dirty);
+	if (!p && !want_clean) {
+		p = TAILQ_FIRST(&pt->pages);
+		*dirty = false;
+	}
 #endif
 	if (p) {
 		atomic_long_sub(1 << pt->order, &allocated_pages);
+		if (*dirty)
+			atomic_long_sub(1 << pt->order, &dirty_pages);
 #ifdef __linux__
 		list_del(&p->lru);
 #elif defined(__FreeBSD__)
-		TAILQ_REMOVE(&pt->pages, p, plinks.q);
+		TAILQ_REMOVE(*dirty ? &pt->dirty : &pt->pages, p, plinks.q);
 #endif
 	}
 	spin_unlock(&pt->lock);
@@ -290,6 +493,114 @@ static struct page *ttm_pool_type_take(struct ttm_pool_type *pt)
 	return p;
 }
 
+/* Take cleared pages from a specific pool_type, NULL when nothing available */
+static struct page *ttm_pool_type_take(struct ttm_pool_type *pt)
+{
+	struct ttm_pool_magazine *mag;
+	struct page *p = NULL;
+	bool dirty;
+
+	mag = ttm_pool_type_mag(pt);
+	if (mag) {
+		spin_lock(&mag->lock);
+		if (mag->count) {
+			mag->hits++;
+		} else {
+			mag->misses++;
+			ttm_pool_mag_refill(pt, mag);
+		}
+		if (mag->count)
+			p = mag->pages[--mag->count];
+		spin_unlock(&mag->lock);
+
+		if (p) {
+			atomic_long_sub(1 << pt->order, &allocated_pages);
+			return p;
+		}
+	}
+
+	p = __ttm_pool_type_take(pt, true, &dirty);
+	if (p && dirty)
+		ttm_pool_clear_pages(pt, p);
+
+	return p;
+}
+
+/* Take pages from a specific pool_type which are about to be freed anyway */
+static struct page *ttm_pool_type_take_any(struct ttm_pool_type *pt)
+{
+	bool dirty;
+
+	return __ttm_pool_type_take(pt, false, &dirty);
+}
+
+/*
+ * Worker clearing the pages given back to a pool_type in deferred clear mode.
+ *
+ * Pages are moved off the dirty list in batches of about
+ * TTM_POOL_CLEAR_BATCH pages so that the lock isn't held while clearing and
+ * concurrent allocations can still grab whatever is already available.
+ */
+static void ttm_pool_type_clear_work(struct work_struct *work)
+{
+	struct ttm_pool_type *pt = container_of(work, typeof(*pt), clear_work);
+	unsigned int num_pages = 1 << pt->order;
+	unsigned int count;
+#ifdef __linux__
+	struct list_head batch;
+#elif defined(__FreeBSD__)
+	struct pglist batch;
+#endif
+	struct page *p;
+
+	do {
+#ifdef __linux__
+		INIT_LIST_HEAD(&batch);
+#elif defined(__FreeBSD__)
+		TAILQ_INIT(&batch);
+#endif
+		count = 0;
+
+		spin_lock(&pt->lock);
+		while (count < TTM_POOL_CLEAR_BATCH) {
+#ifdef __linux__
+			p = list_first_entry_or_null(&pt->dirty, typeof(*p),
+						     lru);
+			if (!p)
+				break;
+			list_move_tail(&p->lru, &batch);
+#elif defined(__FreeBSD__)
+			p = TAILQ_FIRST(&pt->dirty);
+			if (!p)
+				break;
+			TAILQ_REMOVE(&pt->dirty, p, plinks.q);
+			TAILQ_INSERT_TAIL(&batch, p, plinks.q);
+#endif
+			count += num_pages;
+		}
+		spin_unlock(&pt->lock);
+
+#ifdef __linux__
+		list_for_each_entry(p, &batch, lru)
+			ttm_pool_clear_pages(pt, p);
+#elif defined(__FreeBSD__)
+		TAILQ_FOREACH(p, &batch, plinks.q)
+			ttm_pool_clear_pages(pt, p);
+#endif
+
+		spin_lock(&pt->lock);
+#ifdef __linux__
+		list_splice_tail(&batch, &pt->pages);
+#elif defined(__FreeBSD__)
+		TAILQ_CONCAT(&pt->pages, &batch, plinks.q);
+#endif
+		spin_unlock(&pt->lock);
+		atomic_long_sub(count, &dirty_pages);
+
+		cond_resched();
+	} while (count);
+}
+
 /* Initialize and add a pool type to the global shrinker list */
 static void ttm_pool_type_init(struct ttm_pool_type *pt, struct ttm_pool *pool,
 			       enum ttm_caching caching, unsigned int order)
@@ -300,9 +611,24 @@ static void ttm_pool_type_init(struct ttm_pool_type *pt, struct ttm_pool *pool,
 	spin_lock_init(&pt->lock);
 #ifdef __linux__
 	INIT_LIST_HEAD(&pt->pages);
+	INIT_LIST_HEAD(&pt->dirty);
 #elif defined(__FreeBSD__)
 	TAILQ_INIT(&pt->pages);
+	TAILQ_INIT(&pt->dirty);
 #endif
+	INIT_WORK(&pt->clear_work, ttm_pool_type_clear_work);
+
+	pt->mags = NULL;
+	pt->lock_count = 0;
+	pt->lock_contended = 0;
+	if (order <= TTM_POOL_MAG_MAX_ORDER) {
+		unsigned int cpu;
+
+		/* Without magazines we just always use the shared lists */
+		pt->mags = kcalloc(nr_cpu_ids, sizeof(*pt->mags), GFP_KERNEL);
+		for (cpu = 0; pt->mags && cpu < nr_cpu_ids; ++cpu)
+			spin_lock_init(&pt->mags[cpu].lock);
+	}
 
 	spin_lock(&shrinker_lock);
 	list_add_tail(&pt->shrinker_list, &shrinker_list);
@@ -318,8 +644,14 @@ static void ttm_pool_type_fini(struct ttm_pool_type *pt)
 	list_del(&pt->shrinker_list);
 	spin_unlock(&shrinker_lock);
 
-	while ((p = ttm_pool_type_take(pt)))
+	/* Draining may still hand pages to the worker, so stop it last */
+	ttm_pool_type_drain_mags(pt);
+	cancel_work_sync(&pt->clear_work);
+	while ((p = ttm_pool_type_take_any(pt)))
 		ttm_pool_free_page(pt->pool, pt->caching, pt->order, p);
+
+	kfree(pt->mags);
+	pt->mags = NULL;
 }
 
 /* Return the pool_type to use for the given caching and order */
@@ -362,7 +694,11 @@ static unsigned int ttm_pool_shrink(void)
 	list_move_tail(&pt->shrinker_list, &shrinker_list);
 	spin_unlock(&shrinker_lock);
 
-	p = ttm_pool_type_take(pt);
+	p = ttm_pool_type_take_any(pt);
+	if (!p) {
+		ttm_pool_type_drain_mags(pt);
+		p = ttm_pool_type_take_any(pt);
+	}
 	if (p) {
 		ttm_pool_free_page(pt->pool, pt->caching, pt->order, p);
 		num_pages = 1 << pt->order;
@@ -633,7 +969,7 @@ static unsigned long ttm_pool_shrinker_count(struct shrinker *shrink,
 /* Count the number of pages available in a pool_type */
 static unsigned int ttm_pool_type_count(struct ttm_pool_type *pt)
 {
-	unsigned int count = 0;
+	unsigned int count = 0, cpu;
 	struct page *p;
 
 	spin_lock(&pt->lock);
@@ -641,12 +977,19 @@ static unsigned int ttm_pool_type_count(struct ttm_pool_type *pt)
 #ifdef __linux__
 	list_for_each_entry(p, &pt->pages, lru)
 		++count;
+	list_for_each_entry(p, &pt->dirty, lru)
+		++count;
 #elif defined(__FreeBSD__)
 	TAILQ_FOREACH(p, &pt->pages, plinks.q)
 		++count;
+	TAILQ_FOREACH(p, &pt->dirty, plinks.q)
+		++count;
 #endif
 	spin_unlock(&pt->lock);
 
+	for (cpu = 0; pt->mags && cpu < nr_cpu_ids; ++cpu)
+		count += READ_ONCE(pt->mags[cpu].count);
+
 	return count;
 }
 
@@ -672,11 +1015,37 @@ static void ttm_pool_debugfs_orders(struct ttm_pool_type *pt,
 	seq_puts(m, "\n");
 }
 
+/* Dump the magazine hit rate and shared lock contention of the pool types */
+static void ttm_pool_debugfs_mags(struct ttm_pool_type *pt, struct seq_file *m)
+{
+	unsigned long hits = 0, misses = 0, locks = 0, contended = 0;
+	unsigned int i, cpu;
+
+	for (i = 0; i < MAX_ORDER; ++i) {
+		locks += READ_ONCE(pt[i].lock_count);
+		contended += READ_ONCE(pt[i].lock_contended);
+		if (!pt[i].mags)
+			continue;
+
+		for (cpu = 0; cpu < nr_cpu_ids; ++cpu) {
+			hits += READ_ONCE(pt[i].mags[cpu].hits);
+			misses += READ_ONCE(pt[i].mags[cpu].misses);
+		}
+	}
+
+	seq_printf(m, " %10lu %10lu %10lu %10lu\n",
+		   hits, misses, locks, contended);
+}
+
 /* Dump the total amount of allocated pages */
 static void ttm_pool_debugfs_footer(struct seq_file *m)
 {
-	seq_printf(m, "\ntotal\t: %8lu of %8lu\n",
-		   atomic_long_read(&allocated_pages), page_pool_size);
+	long allocated = atomic_long_read(&allocated_pages);
+	long dirty = atomic_long_read(&dirty_pages);
+
+	seq_printf(m, "\ntotal\t: %8lu of %8lu\n", allocated, page_pool_size);
+	seq_printf(m, "clean\t: %8lu\n", max(allocated - dirty, 0L));
+	seq_printf(m, "dirty\t: %8lu\n", max(dirty, 0L));
 }
 
 /* Dump the information for the global pools */
@@ -693,6 +1062,16 @@ static int ttm_pool_debugfs_globals_show(struct seq_file *m, void *data)
 	ttm_pool_debugfs_orders(global_dma32_write_combined, m);
 	seq_puts(m, "uc 32\t:");
 	ttm_pool_debugfs_orders(global_dma32_uncached, m);
+
+	seq_puts(m, "\nmagazine\t       hits     misses      locks  contended\n");
+	seq_puts(m, "wc\t:");
+	ttm_pool_debugfs_mags(global_write_combined, m);
+	seq_puts(m, "uc\t:");
+	ttm_pool_debugfs_mags(global_uncached, m);
+	seq_puts(m, "wc 32\t:");
+	ttm_pool_debugfs_mags(global_dma32_write_combined, m);
+	seq_puts(m, "uc 32\t:");
+	ttm_pool_debugfs_mags(global_dma32_uncached, m);
 	spin_unlock(&shrinker_lock);
 
 	ttm_pool_debugfs_footer(m);
@@ -8,6 +8,7 @@
 
 #include <linux/bitops.h>
 #include <linux/list.h>
+#include <linux/rbtree.h>
 #include <linux/slab.h>
 #include <linux/sched.h>
 
@@ -50,6 +51,9 @@ struct drm_buddy_block {
 	 */
 	struct list_head link;
 	struct list_head tmp_link;
+
+	/* While the block is free it sits in the free tree of its order. */
+	struct rb_node rb;
 };
 
 /* Order-zero must be at least PAGE_SIZE */
@@ -62,8 +66,12 @@ struct drm_buddy_block {
  * drm_buddy_alloc* and drm_buddy_free* should suffice.
  */
 struct drm_buddy {
-	/* Maintain a free list for each order. */
-	struct list_head *free_list;
+	/*
+	 * Maintain a tree of free blocks for each order, sorted by offset, and
+	 * a bitmap of the orders which have free blocks at all.
+	 */
+	struct rb_root *free_tree;
+	unsigned long *free_orders;
 
 	/*
 	 * Maintain explicit binary tree(s) to track the allocation of the
@@ -74,6 +82,17 @@ struct drm_buddy {
 	 */
 	struct drm_buddy_block **roots;
 
+	/*
+	 * Optional cache of freed minimum order blocks. They stay marked as
+	 * allocated, so they aren't merged with their buddies until a bigger
+	 * block is needed.
+	 */
+	struct list_head cache;
+	unsigned int cache_count;
+	unsigned int cache_max;
+	u64 cache_hits;
+	u64 cache_misses;
+
 	/*
 	 * Anything from here is public, and remains static for the lifetime of
 	 * the mm. Everything above is considered do-not-touch.
@@ -134,6 +153,9 @@ int drm_buddy_init(struct drm_buddy *mm, u64 size, u64 chunk_size);
 
 void drm_buddy_fini(struct drm_buddy *mm);
 
+void drm_buddy_cache_enable(struct drm_buddy *mm, unsigned int max_blocks);
+bool drm_buddy_cache_drain(struct drm_buddy *mm);
+
 struct drm_buddy_block *
 drm_get_buddy(struct drm_buddy_block *block);
 
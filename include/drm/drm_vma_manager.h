@@ -26,6 +26,8 @@
 #include <drm/drm_mm.h>
 #include <linux/mm.h>
 #include <linux/rbtree.h>
+#include <linux/rcupdate.h>
+#include <linux/seqlock.h>
 #include <linux/spinlock.h>
 #include <linux/types.h>
 
@@ -47,10 +49,12 @@ struct drm_vma_offset_file {
 	struct rb_node vm_rb;
 	struct drm_file *vm_tag;
 	unsigned long vm_count;
+	struct rcu_head vm_rcu;
 };
 
 struct drm_vma_offset_node {
 	rwlock_t vm_lock;
+	seqcount_t vm_seq;
 	struct drm_mm_node vm_node;
 	struct rb_root vm_files;
 	bool readonly:1;
@@ -61,6 +65,7 @@ struct drm_vma_offset_node {
 
 struct drm_vma_offset_manager {
 	rwlock_t vm_lock;
+	seqcount_t vm_seq;
 	struct drm_mm vm_addr_space_mm;
 };
 
@@ -71,6 +76,9 @@ void drm_vma_offset_manager_destroy(struct drm_vma_offset_manager *mgr);
 struct drm_vma_offset_node *drm_vma_offset_lookup_locked(struct drm_vma_offset_manager *mgr,
 							   unsigned long start,
 							   unsigned long pages);
+struct drm_vma_offset_node *drm_vma_offset_lookup_rcu(struct drm_vma_offset_manager *mgr,
+						      unsigned long start,
+						      unsigned long pages);
 int drm_vma_offset_add(struct drm_vma_offset_manager *mgr,
 		       struct drm_vma_offset_node *node, unsigned long pages);
 void drm_vma_offset_remove(struct drm_vma_offset_manager *mgr,
@@ -105,6 +113,29 @@ drm_vma_offset_exact_lookup_locked(struct drm_vma_offset_manager *mgr,
 	return (node && node->vm_node.start == start) ? node : NULL;
 }
 
+/**
+ * drm_vma_offset_exact_lookup_rcu() - Look up node by exact address under RCU
+ * @mgr: Manager object
+ * @start: Start address (page-based, not byte-based)
+ * @pages: Size of object (page-based)
+ *
+ * Same as drm_vma_offset_lookup_rcu() but does not allow any offset into the
+ * node. It only returns the exact object with the given start address.
+ *
+ * RETURNS:
+ * Node at exact start address @start.
+ */
+static inline struct drm_vma_offset_node *
+drm_vma_offset_exact_lookup_rcu(struct drm_vma_offset_manager *mgr,
+				unsigned long start,
+				unsigned long pages)
+{
+	struct drm_vma_offset_node *node;
+
+	node = drm_vma_offset_lookup_rcu(mgr, start, pages);
+	return (node && node->vm_node.start == start) ? node : NULL;
+}
+
 /**
  * drm_vma_offset_lock_lookup() - Lock lookup for extended private use
  * @mgr: Manager object
@@ -152,6 +183,7 @@ static inline void drm_vma_node_reset(struct drm_vma_offset_node *node)
 	memset(node, 0, sizeof(*node));
 	node->vm_files = RB_ROOT;
 	rwlock_init(&node->vm_lock);
+	seqcount_init(&node->vm_seq);
 }
 
 /**
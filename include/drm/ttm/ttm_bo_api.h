@@ -110,6 +110,29 @@ struct ttm_tt;
  * to derive driver specific types.
  */
 
+/**
+ * struct ttm_bo_vm_stats - CPU fault statistics of a buffer object
+ *
+ * @faults: Number of CPU faults handled for the buffer object.
+ * @prefaulted: Number of pages inserted ahead of the faulting pages.
+ * @prefault_hits: Number of prefaulted pages known to be used, that is the
+ * next fault happened right behind the previous prefault window.
+ * @next_offset: Page offset right behind the last prefault window.
+ * @last_prefaulted: Number of pages prefaulted by the last fault.
+ * @window: Current prefault window, grows for sequential access.
+ * @huge_faults: Number of faults which inserted a full superpage sized chunk
+ * of physically contiguous memory, so it could be mapped with a superpage.
+ */
+struct ttm_bo_vm_stats {
+	unsigned long faults;
+	unsigned long prefaulted;
+	unsigned long prefault_hits;
+	unsigned long next_offset;
+	unsigned long last_prefaulted;
+	unsigned long window;
+	unsigned long huge_faults;
+};
+
 struct ttm_buffer_object {
 	struct drm_gem_object base;
 
@@ -148,6 +171,7 @@ struct ttm_buffer_object {
 
 	unsigned priority;
 	unsigned pin_count;
+	struct ttm_bo_vm_stats vm_stats;
 
 	/**
 	 * Special members that are protected by the reserve lock
@@ -449,6 +473,9 @@ int ttm_mem_evict_first(struct ttm_device *bdev,
 /* Default number of pre-faulted pages in the TTM fault handler */
 #define TTM_BO_VM_NUM_PREFAULT 16
 
+/* Upper bound of the prefault window for sequential access */
+#define TTM_BO_VM_MAX_PREFAULT 512
+
 vm_fault_t ttm_bo_vm_reserve(struct ttm_buffer_object *bo,
 			     struct vm_fault *vmf);
 
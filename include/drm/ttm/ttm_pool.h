@@ -29,11 +29,13 @@
 #include <linux/mmzone.h>
 #include <linux/llist.h>
 #include <linux/spinlock.h>
+#include <linux/workqueue.h>
 #include <drm/ttm/ttm_caching.h>
 
 struct device;
 struct ttm_tt;
 struct ttm_pool;
+struct ttm_pool_magazine;
 struct ttm_operation_ctx;
 
 /**
@@ -43,8 +45,13 @@ struct ttm_operation_ctx;
  * @order: the allocation order our pages have
  * @caching: the caching type our pages have
  * @shrinker_list: our place on the global shrinker list
- * @lock: protection of the page list
- * @pages: the list of pages in the pool
+ * @lock: protection of the page lists
+ * @pages: the list of cleared pages in the pool
+ * @dirty: the list of pages waiting to be cleared by @clear_work
+ * @clear_work: worker clearing the pages on the @dirty list
+ * @mags: per CPU caches of cleared pages in front of @pages, might be NULL
+ * @lock_count: number of times @lock was taken by the alloc and free paths
+ * @lock_contended: number of times @lock was found contended by those paths
  */
 struct ttm_pool_type {
 	struct ttm_pool *pool;
@@ -56,9 +63,17 @@ struct ttm_pool_type {
 	spinlock_t lock;
 #ifdef __linux__
 	struct list_head pages;
+	struct list_head dirty;
 #elif defined(__FreeBSD__)
 	struct pglist pages;
+	struct pglist dirty;
 #endif
+
+	struct work_struct clear_work;
+
+	struct ttm_pool_magazine *mags;
+	unsigned long lock_count;
+	unsigned long lock_contended;
 };
 
 /**
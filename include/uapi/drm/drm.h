@@ -805,6 +805,35 @@ struct drm_syncobj_timeline_array {
 	__u32 flags;
 };
 
+#define DRM_SYNCOBJ_OP_SIGNAL	0 /* signal point, or the binary syncobj if 0 */
+#define DRM_SYNCOBJ_OP_RESET	1 /* remove the fence from the syncobj */
+#define DRM_SYNCOBJ_OP_QUERY	2 /* last signaled point is returned in point */
+#define DRM_SYNCOBJ_OP_TRANSFER	3 /* src_handle:src_point to handle:point */
+struct drm_syncobj_op {
+	__u32 op;
+	__u32 handle;
+	__u64 point;
+	__u32 src_handle;
+	/* DRM_SYNCOBJ_QUERY_FLAGS_* or DRM_SYNCOBJ_WAIT_FLAGS_WAIT_FOR_SUBMIT */
+	__u32 flags;
+	__u64 src_point;
+};
+
+struct drm_syncobj_op_array {
+	/* array of struct drm_syncobj_op, executed in order */
+	__u64 ops;
+	__u32 count_ops;
+	__u32 flags;
+	/* number of operations executed, written back */
+	__u32 count_done;
+	/*
+	 * written back: 0, or the error which stopped the batch at operation
+	 * count_done. The ioctl still succeeds in that case as the operations
+	 * before it have been applied.
+	 */
+	__s32 error;
+};
+
 
 /* Query current scanout sequence number */
 struct drm_crtc_get_sequence {
@@ -973,6 +1002,12 @@ extern "C" {
 
 #define DRM_IOCTL_MODE_GETFB2		DRM_IOWR(0xCE, struct drm_mode_fb_cmd2)
 
+/*
+ * Not an upstream ioctl. Upstream hands out the generic numbers in order
+ * from 0xA0, so take the last one to stay clear of them.
+ */
+#define DRM_IOCTL_SYNCOBJ_OPS		DRM_IOWR(0xFF, struct drm_syncobj_op_array)
+
 /*
  * Device specific ioctls should only be in their respective headers
  * The device specific ioctl range is from 0x40 to 0x9f.
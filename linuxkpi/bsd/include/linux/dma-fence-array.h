@@ -61,6 +61,7 @@ struct dma_fence_array {
 	atomic_t num_pending;
 	struct dma_fence **fences;
 	struct irq_work work;
+	bool signal_on_any;
 };
 
 #ifndef BSDTNG
@@ -99,6 +100,32 @@ bool dma_fence_match_context(struct dma_fence *fence, u64 context);
 struct dma_fence *dma_fence_array_first(struct dma_fence *head);
 struct dma_fence *dma_fence_array_next(struct dma_fence *head,
 				       unsigned int index);
+
+#define	DMA_FENCE_ARRAY_BUILDER_INLINE	8
+
+/**
+ * struct dma_fence_array_builder - collect fences into a single fence
+ * @fences: fences collected so far, each holding a reference
+ * @num_fences: number of entries used in @fences
+ * @max_fences: number of entries allocated in @fences
+ * @inline_fences: initial storage for @fences
+ *
+ * See dma_fence_array_builder_add() and dma_fence_array_builder_finish().
+ */
+struct dma_fence_array_builder {
+	struct dma_fence **fences;
+	unsigned int num_fences;
+	unsigned int max_fences;
+	struct dma_fence *inline_fences[DMA_FENCE_ARRAY_BUILDER_INLINE];
+};
+
+void dma_fence_array_builder_init(struct dma_fence_array_builder *b);
+void dma_fence_array_builder_add(struct dma_fence_array_builder *b,
+				 struct dma_fence *fence);
+struct dma_fence *
+dma_fence_array_builder_finish(struct dma_fence_array_builder *b,
+			       u64 context, unsigned seqno);
+void dma_fence_array_builder_fini(struct dma_fence_array_builder *b);
 #endif /* BSDTNG */
 
 #endif /* _LINUX_DMA_FENCE_ARRAY_H_ */
@@ -29,6 +29,9 @@
 
 #include <linux/dma-fence.h>
 #include <linux/irq_work.h>
+#include <linux/rbtree.h>
+
+struct dma_fence_chain_index;
 
 struct dma_fence_chain {
 	struct dma_fence base;
@@ -38,6 +41,9 @@ struct dma_fence_chain {
 	struct dma_fence *fence;
 	struct dma_fence_cb cb;
 	struct irq_work work;
+	/* seqno index shared with the other points of this timeline */
+	struct dma_fence_chain_index *index;
+	struct rb_node index_node;
 };
 
 extern const struct dma_fence_ops dma_fence_chain_ops;
@@ -73,30 +79,6 @@ dma_fence_chain_contained(struct dma_fence *fence)
 
 	return chain ? chain->fence : fence;
 }
-
-/**
- * dma_fence_chain_alloc
- *
- * Returns a new struct dma_fence_chain object or NULL on failure.
- */
-static inline struct dma_fence_chain *dma_fence_chain_alloc(void)
-{
-	return kmalloc(sizeof(struct dma_fence_chain), GFP_KERNEL);
-};
-
-/**
- * dma_fence_chain_free
- * @chain: chain node to free
- *
- * Frees up an allocated but not used struct dma_fence_chain object. This
- * doesn't need an RCU grace period since the fence was never initialized nor
- * published. After dma_fence_chain_init() has been called the fence must be
- * released by calling dma_fence_put(), and not through this function.
- */
-static inline void dma_fence_chain_free(struct dma_fence_chain *chain)
-{
-	kfree(chain);
-};
 #endif /* BSDTNG */
 
 #define dma_fence_chain_for_each(iter, head)	\
@@ -106,6 +88,8 @@ static inline void dma_fence_chain_free(struct dma_fence_chain *chain)
 struct dma_fence_chain *to_dma_fence_chain(struct dma_fence *fence);
 struct dma_fence *dma_fence_chain_walk(struct dma_fence *fence);
 int dma_fence_chain_find_seqno(struct dma_fence **fence, uint64_t seqno);
+struct dma_fence_chain *dma_fence_chain_alloc(void);
+void dma_fence_chain_free(struct dma_fence_chain *chain);
 void dma_fence_chain_init(struct dma_fence_chain *chain, struct dma_fence *prev,
   struct dma_fence *fence, uint64_t seqno);
 
@@ -57,6 +57,7 @@ struct dma_fence {
 	unsigned long flags;
 	struct kref refcount;
 	int error;
+	ktime_t stats_start;	/* init time, only with hw.dmabuf.fence_stats */
 };
 
 enum dma_fence_flag_bits {
@@ -87,6 +88,7 @@ struct dma_fence_ops {
 	void (*fence_value_str)(struct dma_fence *fence, char *str, int size);
 	void (*timeline_value_str)(struct dma_fence *fence,
 				   char *str, int size);
+	void (*set_deadline)(struct dma_fence *fence, ktime_t deadline);
 };
 
 void dma_fence_init(struct dma_fence *fence, const struct dma_fence_ops *ops,
@@ -109,6 +111,7 @@ int dma_fence_add_callback(struct dma_fence *fence,
 bool dma_fence_remove_callback(struct dma_fence *fence,
     struct dma_fence_cb *cb);
 void dma_fence_enable_sw_signaling(struct dma_fence *fence);
+void dma_fence_set_deadline(struct dma_fence *fence, ktime_t deadline);
 
 
 int dma_fence_get_status(struct dma_fence *fence);
@@ -0,0 +1,20 @@
+#ifndef _BSD_LKPI_LINUX_IO_H_
+#define	_BSD_LKPI_LINUX_IO_H_
+
+#include_next <linux/io.h>
+
+/*
+ * Cached ioremap for system coherent resources, e.g. TTM iomem placements
+ * with ttm_cached caching.  Mapping those uncached makes CPU reads crawl.
+ */
+#ifndef ioremap_cache
+#ifdef VM_MEMATTR_WRITE_BACK
+#define	ioremap_cache(addr, size)					\
+    _ioremap_attr((addr), (size), VM_MEMATTR_WRITE_BACK)
+#else
+#define	ioremap_cache(addr, size)					\
+    _ioremap_attr((addr), (size), VM_MEMATTR_DEFAULT)
+#endif
+#endif
+
+#endif /* _BSD_LKPI_LINUX_IO_H_ */
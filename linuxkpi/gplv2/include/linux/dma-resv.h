@@ -146,12 +146,31 @@ enum dma_resv_usage {
 };
 #endif
 
+#ifdef BSDTNG
+/* Number of fences a dma_resv can hold before it has to allocate a list */
+#define DMA_RESV_INLINE_FENCES	4
+
+/*
+ * Same layout as struct dma_resv_list but with a fixed size table, so that it
+ * can be embedded into struct dma_resv and published through its fences.
+ */
+struct dma_resv_inline_list {
+	struct rcu_head rcu;
+	u32 num_fences, max_fences;
+	struct dma_fence __rcu *table[DMA_RESV_INLINE_FENCES];
+};
+#endif
+
 /**
  * struct dma_resv - a reservation object manages fences for a buffer
  * @lock: update side lock
  * @seq: sequence count for managing RCU read-side synchronization
  * @fence_excl: the exclusive fence, if there is one currently
  * @fence: list of current shared fences
+ * @inline_fences: storage used as @fences until more than
+ * DMA_RESV_INLINE_FENCES slots are reserved, never reused once replaced
+ * @fences_hwm: decaying high-water mark of the slots in use, used to shrink
+ * @fences again after a burst
  */
 struct dma_resv {
 	struct ww_mutex lock;
@@ -164,6 +183,10 @@ struct dma_resv {
 	struct dma_fence __rcu *fence_excl;
 #endif
 	struct dma_resv_list __rcu *fences;
+#ifdef BSDTNG
+	struct dma_resv_inline_list inline_fences;
+	u32 fences_hwm;
+#endif
 };
 
 #ifdef BSDTNG
@@ -220,6 +243,9 @@ struct dma_resv_iter {
 	/** @num_fences: number of fences */
 	unsigned int num_fences;
 
+	/** @seq: &dma_resv.seq when the fences were sampled */
+	unsigned int seq;
+
 	/** @is_restarted: true if this is the first returned fence */
 	bool is_restarted;
 };
@@ -112,5 +112,18 @@ might_alloc(const unsigned int flags)
 }
 
 #define IOMEM_ERR_PTR(err) (__force void __iomem *)ERR_PTR(err)
+
+/*
+ * Insert *nr physically contiguous pfns starting at pfn for the pages at
+ * addr in one go. On return *nr holds the number of pages inserted.
+ *
+ * With large set, 2M aligned parts of the range may get mapped with
+ * superpages. The psind of every inserted page is reset, only fully inserted
+ * and aligned chunks are flagged again. Pages flagged this way must still get
+ * their psind reset before they are handed back to the VM.
+ */
+vm_fault_t lkpi_vmf_insert_pfn_range_prot_locked(struct vm_area_struct *vma,
+    unsigned long addr, unsigned long pfn, unsigned long *nr, pgprot_t prot,
+    bool large);
 #endif /* BSDTNG */
 #endif
\ No newline at end of file
@@ -0,0 +1,40 @@
+#ifndef _LINUX_GPLV2_VMALLOC_H_
+#define _LINUX_GPLV2_VMALLOC_H_
+
+#include_next <linux/vmalloc.h>
+
+#include <linux/types.h>
+#include <linux/page.h>
+
+/*
+ * linuxkpi has no vmap_pfn(), mappings created by it live in their own KVA
+ * window so that vunmap() can recognize them from the address alone.
+ */
+extern vm_offset_t linuxkpi_vmap_pfn_base;
+extern vm_offset_t linuxkpi_vmap_pfn_end;
+
+void *linuxkpi_vmap_pfn(unsigned long *pfns, unsigned int count,
+    pgprot_t prot);
+void linuxkpi_vunmap_pfn(void *addr);
+
+static inline bool
+linuxkpi_is_vmap_pfn_addr(const void *addr)
+{
+	vm_offset_t va = (vm_offset_t)addr;
+
+	return (va >= linuxkpi_vmap_pfn_base && va < linuxkpi_vmap_pfn_end);
+}
+
+static inline void
+linuxkpi_vunmap(void *addr)
+{
+	if (linuxkpi_is_vmap_pfn_addr(addr))
+		linuxkpi_vunmap_pfn(addr);
+	else
+		vunmap(addr);
+}
+
+#define	vmap_pfn(pfns, count, prot)	linuxkpi_vmap_pfn(pfns, count, prot)
+#define	vunmap(addr)			linuxkpi_vunmap(addr)
+
+#endif /* _LINUX_GPLV2_VMALLOC_H_ */
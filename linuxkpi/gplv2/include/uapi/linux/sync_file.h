@@ -31,6 +31,36 @@ struct sync_merge_data {
 	__u32	pad;
 };
 
+/**
+ * struct sync_merge_many_data - data passed to the N-way merge ioctl
+ * @name:	name of new fence
+ * @fds:	pointer to an array of __s32 file descriptors of the fences
+ *		to merge with the calling fd
+ * @num_fds:	number of entries in @fds
+ * @fence:	returns the fd of the new fence to userspace
+ * @flags:	merge_data flags
+ * @pad:	padding for 64-bit alignment, should always be zero
+ */
+struct sync_merge_many_data {
+	char	name[32];
+	__u64	fds;
+	__u32	num_fds;
+	__s32	fence;
+	__u32	flags;
+	__u32	pad;
+};
+
+/**
+ * struct sync_set_deadline - data passed to the deadline ioctl
+ * @deadline_ns:	absolute CLOCK_MONOTONIC time, in ns, by which the fence
+ *			should signal
+ * @pad:		must be zero
+ */
+struct sync_set_deadline {
+	__u64	deadline_ns;
+	__u64	pad;
+};
+
 /**
  * struct sync_fence_info - detailed fence information
  * @obj_name:		name of parent sync_timeline
@@ -95,4 +125,27 @@ struct sync_file_info {
  */
 #define SYNC_IOC_FILE_INFO	_IOWR(SYNC_IOC_MAGIC, 4, struct sync_file_info)
 
+/**
+ * DOC: SYNC_IOC_SET_DEADLINE - set a deadline hint on a fence
+ *
+ * Takes a struct sync_set_deadline.  Tells the drivers behind the fences of
+ * the sync_file when their signal is needed, for example the vblank a
+ * compositor wants to present at.  This is only a hint: a driver may raise
+ * the priority or the clocks of the work, or do nothing at all.
+ */
+#define SYNC_IOC_SET_DEADLINE	_IOW(SYNC_IOC_MAGIC, 5, struct sync_set_deadline)
+
+/**
+ * DOC: SYNC_IOC_MERGE_MANY - merge any number of fences
+ *
+ * Takes a struct sync_merge_many_data.  Creates a new fence containing the
+ * latest sync_pt of every timeline found in the calling fd and the fds in
+ * sync_merge_many_data.fds, leaving out those already signaled.  Returns the
+ * new fence's fd in sync_merge_many_data.fence
+ *
+ * Not an upstream ioctl. Upstream hands out the numbers in order, so take
+ * the last one to stay clear of them.
+ */
+#define SYNC_IOC_MERGE_MANY	_IOWR(SYNC_IOC_MAGIC, 0xFF, struct sync_merge_many_data)
+
 #endif /* _UAPI_LINUX_SYNC_H */
@@ -0,0 +1,152 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <sys/types.h>
+#include <sys/param.h>
+#include <sys/systm.h>
+#include <sys/lock.h>
+#include <sys/rwlock.h>
+#include <sys/counter.h>
+#include <sys/kernel.h>
+#include <sys/sysctl.h>
+
+#include <vm/vm.h>
+#include <vm/vm_object.h>
+#include <vm/vm_page.h>
+#include <vm/vm_phys.h>
+#include <vm/pmap.h>
+
+#include <linux/mm.h>
+#include <linux/export.h>
+
+SYSCTL_DECL(_compat_linuxkpi);
+
+static COUNTER_U64_DEFINE_EARLY(lkpi_vmf_superpages);
+SYSCTL_COUNTER_U64(_compat_linuxkpi, OID_AUTO, vmf_superpages, CTLFLAG_RD,
+    &lkpi_vmf_superpages,
+    "2M ranges inserted by fault handlers which can be mapped as superpages");
+
+/*
+ * Flag the 2M aligned chunks of a freshly inserted pfn range as superpage
+ * capable.  vm_fault_populate() then maps them with a single large page entry
+ * as long as the virtual address is aligned the same way and the whole chunk
+ * was inserted by this fault; anything else falls back to 4K pages.
+ *
+ * The hint lives in the shared vm_page, so every page inserted here has it
+ * cleared first: a page flagged by an earlier mapping of the same physical
+ * memory (pool pages, LMEM, the aperture) must not get a later 4K mapping
+ * promoted over memory it was never given.
+ */
+static void
+lkpi_vmf_mark_superpages(unsigned long addr, unsigned long pfn,
+    unsigned long count)
+{
+	unsigned long npages, i;
+	vm_page_t m;
+
+	if (pagesizes[1] == 0)
+		return;
+
+	npages = atop(pagesizes[1]);
+	if (((atop(addr) - pfn) & (npages - 1)) != 0)
+		return;
+
+	i = roundup2(pfn, npages) - pfn;
+	for (; i + npages <= count; i += npages) {
+		m = PHYS_TO_VM_PAGE(ptoa(pfn + i));
+		if (m == NULL)
+			continue;
+		m->psind = 1;
+		counter_u64_add(lkpi_vmf_superpages, 1);
+	}
+}
+
+/*
+ * Batched variant of lkpi_vmf_insert_pfn_prot_locked() for a physically
+ * contiguous run of pfns, used by the prefaulting fault handlers.
+ *
+ * Instead of a vm_page_grab() per page the object is searched once for the
+ * next resident page, everything below it is free and gets inserted directly.
+ * Resident pages and pages still owned by another object go through the
+ * single page path, which may drop the object lock, so the search restarts
+ * after them.  The pages are left busy for vm_fault_populate(), which maps
+ * the whole run with one pmap_enter() per page or per superpage.
+ *
+ * The range is clamped to the vma.  Inserting stops at the first page which
+ * fails, the caller only has to care about the error if nothing got in.
+ */
+vm_fault_t
+lkpi_vmf_insert_pfn_range_prot_locked(struct vm_area_struct *vma,
+    unsigned long addr, unsigned long pfn, unsigned long *nr, pgprot_t prot,
+    bool large)
+{
+	vm_object_t vm_obj = vma->vm_obj;
+	vm_memattr_t attr = pgprot2cachemode(prot);
+	vm_fault_t ret = VM_FAULT_NOPAGE;
+	unsigned long i, count;
+	vm_pindex_t pindex;
+	vm_page_t m, next;
+
+	VM_OBJECT_ASSERT_WLOCKED(vm_obj);
+
+	count = min(*nr, (vma->vm_end - addr) >> PAGE_SHIFT);
+	pindex = OFF_TO_IDX(addr - vma->vm_start);
+	next = vm_page_find_least(vm_obj, pindex);
+	for (i = 0; i < count; i++, pindex++) {
+		m = PHYS_TO_VM_PAGE(ptoa(pfn + i));
+		if ((next == NULL || next->pindex != pindex) &&
+		    vm_page_tryxbusy(m)) {
+			if (m->object != NULL) {
+				vm_page_xunbusy(m);
+				goto slow;
+			}
+			if (vm_page_insert(m, vm_obj, pindex)) {
+				vm_page_xunbusy(m);
+				ret = VM_FAULT_OOM;
+				break;
+			}
+			vm_page_valid(m);
+			pmap_page_set_memattr(m, attr);
+			m->psind = 0;
+			if (vma->vm_pfn_count++ == 0)
+				vma->vm_pfn_first = pindex;
+			continue;
+		}
+slow:
+		ret = lkpi_vmf_insert_pfn_prot_locked(vma, addr + ptoa(i),
+		    pfn + i, prot);
+		if (ret & VM_FAULT_ERROR)
+			break;
+		m->psind = 0;
+		next = vm_page_find_least(vm_obj, pindex + 1);
+	}
+	*nr = i;
+
+	if (large)
+		lkpi_vmf_mark_superpages(addr, pfn, i);
+
+	return (i != 0 ? VM_FAULT_NOPAGE : ret);
+}
+EXPORT_SYMBOL(lkpi_vmf_insert_pfn_range_prot_locked);
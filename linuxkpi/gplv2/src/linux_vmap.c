@@ -0,0 +1,205 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <sys/types.h>
+#include <sys/param.h>
+#include <sys/systm.h>
+#include <sys/kernel.h>
+#include <sys/lock.h>
+#include <sys/mutex.h>
+#include <sys/malloc.h>
+#include <sys/queue.h>
+#include <sys/vmem.h>
+
+#include <vm/vm.h>
+#include <vm/vm_extern.h>
+#include <vm/vm_page.h>
+#include <vm/pmap.h>
+
+#include <linux/bug.h>
+#include <linux/vmalloc.h>
+#include <linux/export.h>
+
+/*
+ * vmap_pfn() as defined in linux
+ *
+ * The base linuxkpi only knows how to vmap() an array of struct page, which
+ * leaves iomem without a struct page (e.g. LMEM behind a BAR) without a
+ * contiguous kernel mapping.  Here we allocate KVA from a window reserved for
+ * these mappings and enter each pfn on its own.  Device memory gets the
+ * memory attribute requested through the pgprot, while pfns backed by RAM
+ * keep the attribute of their vm_page so that we never create an alias with
+ * a different caching mode than the direct map.
+ *
+ * As all the mappings live in the window, vunmap() can tell them apart from
+ * the ones created by the base linuxkpi vmap() by looking at the address
+ * alone.  Only the size of each mapping is kept in a small hash.
+ */
+
+#ifdef __LP64__
+#define	LINUXKPI_VMAP_PFN_KVA	(8UL << 30)
+#else
+#define	LINUXKPI_VMAP_PFN_KVA	(64UL << 20)
+#endif
+#define	LINUXKPI_VMAP_PFN_HASH	64
+
+struct linuxkpi_vmap_pfn {
+	LIST_ENTRY(linuxkpi_vmap_pfn) link;
+	vm_offset_t va;
+	vm_size_t size;
+};
+
+static MALLOC_DEFINE(M_LKPI_VMAP, "lkpivmap", "linuxkpi vmap_pfn mappings");
+
+static LIST_HEAD(, linuxkpi_vmap_pfn)
+    linuxkpi_vmap_pfn_hash[LINUXKPI_VMAP_PFN_HASH];
+static struct mtx linuxkpi_vmap_pfn_mtx;
+MTX_SYSINIT(linuxkpi_vmap_pfn, &linuxkpi_vmap_pfn_mtx, "lkpivmap", MTX_DEF);
+
+static vmem_t *linuxkpi_vmap_pfn_arena;
+vm_offset_t linuxkpi_vmap_pfn_base;
+vm_offset_t linuxkpi_vmap_pfn_end;
+EXPORT_SYMBOL(linuxkpi_vmap_pfn_base);
+EXPORT_SYMBOL(linuxkpi_vmap_pfn_end);
+
+#define	LINUXKPI_VMAP_PFN_BUCKET(va)					\
+	(&linuxkpi_vmap_pfn_hash[atop(va) % LINUXKPI_VMAP_PFN_HASH])
+
+static void
+linuxkpi_vmap_pfn_init(void *arg __unused)
+{
+	vm_offset_t base;
+
+	base = kva_alloc(LINUXKPI_VMAP_PFN_KVA);
+	if (base == 0) {
+		printf("linuxkpi: failed to reserve KVA for vmap_pfn()\n");
+		return;
+	}
+
+	linuxkpi_vmap_pfn_arena = vmem_create("lkpivmap", base,
+	    LINUXKPI_VMAP_PFN_KVA, PAGE_SIZE, 0, M_WAITOK);
+	linuxkpi_vmap_pfn_base = base;
+	linuxkpi_vmap_pfn_end = base + LINUXKPI_VMAP_PFN_KVA;
+}
+SYSINIT(linuxkpi_vmap_pfn, SI_SUB_DRIVERS, SI_ORDER_FIRST,
+    linuxkpi_vmap_pfn_init, NULL);
+
+static void
+linuxkpi_vmap_pfn_uninit(void *arg __unused)
+{
+	if (linuxkpi_vmap_pfn_arena == NULL)
+		return;
+
+	linuxkpi_vmap_pfn_end = linuxkpi_vmap_pfn_base;
+	vmem_destroy(linuxkpi_vmap_pfn_arena);
+	kva_free(linuxkpi_vmap_pfn_base, LINUXKPI_VMAP_PFN_KVA);
+}
+SYSUNINIT(linuxkpi_vmap_pfn, SI_SUB_DRIVERS, SI_ORDER_FIRST,
+    linuxkpi_vmap_pfn_uninit, NULL);
+
+static void
+linuxkpi_vmap_pfn_enter(vm_offset_t va, vm_paddr_t pa, vm_memattr_t dev_attr)
+{
+	vm_memattr_t attr;
+	vm_page_t m;
+
+	/*
+	 * Never alias RAM with a caching mode different from the direct map.
+	 * Fictitious pages describe device memory, they take the pgprot.
+	 */
+	m = PHYS_TO_VM_PAGE(pa);
+	if (m != NULL && (m->flags & PG_FICTITIOUS) == 0)
+		attr = pmap_page_get_memattr(m);
+	else
+		attr = dev_attr;
+
+#if defined(__amd64__) || defined(__i386__) || defined(__powerpc__)
+	pmap_kenter_attr(va, pa, attr);
+#elif defined(__aarch64__) || defined(__riscv)
+	pmap_kenter(va, PAGE_SIZE, pa, attr);
+#else
+#error "vmap_pfn() is not implemented for this architecture"
+#endif
+}
+
+void *
+linuxkpi_vmap_pfn(unsigned long *pfns, unsigned int count, pgprot_t prot)
+{
+	struct linuxkpi_vmap_pfn *map;
+	vm_memattr_t attr;
+	unsigned int i;
+
+	if (count == 0)
+		return (NULL);
+
+	if (linuxkpi_vmap_pfn_arena == NULL) {
+		WARN_ONCE(1, "vmap_pfn() without a KVA window\n");
+		return (NULL);
+	}
+
+	map = malloc(sizeof(*map), M_LKPI_VMAP, M_WAITOK | M_ZERO);
+	map->size = ptoa((vm_size_t)count);
+	if (vmem_alloc(linuxkpi_vmap_pfn_arena, map->size,
+	    M_BESTFIT | M_NOWAIT, &map->va) != 0) {
+		free(map, M_LKPI_VMAP);
+		return (NULL);
+	}
+
+	attr = pgprot2cachemode(prot);
+	for (i = 0; i < count; i++)
+		linuxkpi_vmap_pfn_enter(map->va + ptoa(i), ptoa(pfns[i]), attr);
+
+	mtx_lock(&linuxkpi_vmap_pfn_mtx);
+	LIST_INSERT_HEAD(LINUXKPI_VMAP_PFN_BUCKET(map->va), map, link);
+	mtx_unlock(&linuxkpi_vmap_pfn_mtx);
+
+	return ((void *)map->va);
+}
+EXPORT_SYMBOL(linuxkpi_vmap_pfn);
+
+/* Tear down a mapping created by linuxkpi_vmap_pfn() */
+void
+linuxkpi_vunmap_pfn(void *addr)
+{
+	struct linuxkpi_vmap_pfn *map;
+	vm_offset_t va = (vm_offset_t)addr;
+
+	mtx_lock(&linuxkpi_vmap_pfn_mtx);
+	LIST_FOREACH(map, LINUXKPI_VMAP_PFN_BUCKET(va), link) {
+		if (map->va == va) {
+			LIST_REMOVE(map, link);
+			break;
+		}
+	}
+	mtx_unlock(&linuxkpi_vmap_pfn_mtx);
+
+	if (WARN_ON(map == NULL))
+		return;
+
+	pmap_qremove(map->va, atop(map->size));
+	vmem_free(linuxkpi_vmap_pfn_arena, map->va, map->size);
+	free(map, M_LKPI_VMAP);
+}
+EXPORT_SYMBOL(linuxkpi_vunmap_pfn);